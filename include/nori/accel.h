@@ -31,6 +31,11 @@ NORI_NAMESPACE_BEGIN
 struct OctreeNode{
     // 한번 분할할 때마다 자식 8개씩 포인터로 바로 할당할 예정
     OctreeNode* children[8] = {nullptr};
+    /// Release the subtree
+    ~OctreeNode() {
+        for (OctreeNode *child : children)
+            delete child;
+    }
     // 데이터를 받아올 예정.
     std::vector<uint32_t> triangles;
     // 데이터가 들어있거나 , 분할된 자식이 없다면 리프 노이드인거다.
@@ -76,7 +81,7 @@ public:
 private:
     Mesh         *m_mesh = nullptr; ///< Mesh (only a single one for now)
     BoundingBox3f m_bbox;           ///< Bounding box of the entire scene
-    OctreeNode* m_root = nullptr;
+    std::shared_ptr<OctreeNode> m_root; ///< Octree (shared with other scenes using the same geometry)
 };
 
 
@@ -0,0 +1,127 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <nori/block.h>
+#include <nori/bitmap.h>
+#include <pcg32.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Arbitrary output variables (AOVs)
+ *
+ * Auxiliary images that are rendered along with the actual image (the
+ * "beauty" pass) from the same camera rays. The AOVs need the first hit of
+ * each camera ray, which \ref Integrator::Li() does not expose. Only
+ * integrators that implement \ref Integrator::shade() share it with the
+ * beauty pass; for all others, \ref renderBlock() intersects every camera
+ * ray a second time.
+ */
+enum EAOV {
+    /// Reflectance of the surface seen through the pixel (see \ref BSDF::getAlbedo())
+    EAlbedo = 0,
+    /// Shading normal in world space
+    ENormal,
+    /// Distance along the camera ray
+    EDepth,
+    /// Ambient occlusion (one cosine-weighted occlusion ray per sample)
+    EAmbientOcclusion,
+    /// Variance of the luminance of the individual samples in the pixel
+    EVariance,
+    EAOVCount
+};
+
+/// Values of all AOVs for one camera ray (scalar AOVs are stored in all channels)
+struct AOVRecord {
+    Color3f value[EAOVCount];
+};
+
+/**
+ * \brief Multi-channel frame buffer storing a set of AOVs
+ *
+ * Each enabled AOV is accumulated in an \ref ImageBlock of its own, using the
+ * same reconstruction filter as the beauty pass. Blocks of this class are
+ * used like image blocks: the render threads splat samples into small ones,
+ * which are merged into one that covers the entire image.
+ */
+class AOVBuffer {
+public:
+    /**
+     * \brief Create a frame buffer for the AOVs in \c mask
+     *
+     * \c mask has one bit per \ref EAOV (see \ref parseAOVs()).
+     */
+    AOVBuffer(uint32_t mask, const Vector2i &size, const ReconstructionFilter *filter);
+
+    /// Parse a comma-separated list of AOV names (e.g. "albedo,normal") into a mask
+    static uint32_t parseAOVs(const std::string &names);
+
+    /// Return the name of an AOV, which is also its layer name in EXR files
+    static const char *getName(EAOV aov);
+
+    /// Return the bit mask of the enabled AOVs
+    uint32_t getMask() const { return m_mask; }
+
+    /// Is the given AOV enabled?
+    bool has(EAOV aov) const { return (m_mask & (1u << aov)) != 0; }
+
+    /// Move all blocks to the given block of the image and clear them
+    void reset(const Point2i &offset, const Vector2i &size);
+
+    /**
+     * \brief Seed the ambient occlusion samples for a new image block
+     *
+     * The counterpart of \ref Sampler::prepare(): the occlusion rays draw
+     * from a generator of their own, so that the beauty pass does not
+     * depend on the enabled AOVs.
+     */
+    void prepare(const ImageBlock &block, uint32_t pass);
+
+    /// Draw the direction sample of an ambient occlusion ray
+    Point2f nextAOSample() { return Point2f(m_random.nextFloat(), m_random.nextFloat()); }
+
+    /// Record the AOVs of a sample with the given position
+    void put(const Point2f &pos, const AOVRecord &record);
+
+    /// Merge another frame buffer (with the same AOVs) into this one
+    void put(AOVBuffer &buffer);
+
+    /// Use striped locking for merges (see \ref ImageBlock::setStripedLocking())
+    void setStripedLocking(bool value);
+
+    /**
+     * \brief Normalize all AOVs in place (see \ref ImageBlock::normalize())
+     *
+     * The variance AOV accumulates the luminance of the samples and its
+     * square, which are turned into the sample variance here.
+     */
+    void normalize();
+
+    /// Return a view of a normalized AOV (which must be enabled)
+    BitmapView getView(EAOV aov) const;
+
+    /// Attach the normalized AOVs as layers of an EXR file
+    void addLayers(BitmapView &view) const;
+protected:
+    uint32_t m_mask;
+    std::unique_ptr<ImageBlock> m_blocks[EAOVCount];
+    pcg32 m_random;
+};
+
+NORI_NAMESPACE_END
@@ -20,9 +20,110 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
+#include <map>
+#include <vector>
 
 NORI_NAMESPACE_BEGIN
 
+/// Storage format of the OpenEXR files written by \ref Bitmap::saveEXR()
+struct EXROptions {
+    /// Compression codecs supported by OpenEXR (numbered as in \c Imf::Compression)
+    enum ECompression {
+        ENone = 0, ERLE, EZIPS, EZIP, EPIZ, EPXR24, EB44, EB44A, EDWAA, EDWAB
+    };
+
+    /// Store the channels as 16-bit half floats instead of 32-bit floats
+    bool half = false;
+
+    /// Edge length of the tiles in pixels (0 writes a scanline file)
+    int tileSize = 0;
+
+    /// Compression codec
+    ECompression compression = EZIP;
+
+    /// Parse the name of a compression codec ("none", "zip", "piz", "dwaa", ..)
+    static ECompression parseCompression(const std::string &name);
+
+    /// Return a human-readable string summary
+    std::string toString() const;
+};
+
+/**
+ * \brief Non-owning view of RGB pixels stored with arbitrary strides
+ *
+ * This makes it possible to write images to disk straight from memory
+ * that is laid out differently than a \ref Bitmap, e.g. the normalized
+ * interior of an \ref ImageBlock (see \ref ImageBlock::getView()).
+ */
+class BitmapView {
+public:
+    /**
+     * \brief Create a view
+     *
+     * \param data
+     *     Red channel of the top left pixel (followed by green and blue)
+     * \param size
+     *     Size of the image
+     * \param pixelStride
+     *     Distance between horizontally adjacent pixels (in floats)
+     * \param rowStride
+     *     Distance between vertically adjacent pixels (in floats)
+     */
+    BitmapView(const float *data, const Vector2i &size, size_t pixelStride, size_t rowStride)
+        : m_data(data), m_size(size), m_pixelStride(pixelStride), m_rowStride(rowStride) { }
+
+    /// Return the size of the image
+    const Vector2i &getSize() const { return m_size; }
+
+    /// Return the color of a pixel
+    Color3f coeff(int y, int x) const {
+        const float *ptr = m_data + y * m_rowStride + x * m_pixelStride;
+        return Color3f(ptr[0], ptr[1], ptr[2]);
+    }
+
+    /// Attach a string attribute that is written to the header of EXR files
+    void setMetadata(const std::string &name, const std::string &value) {
+        m_metadata[name] = value;
+    }
+
+    /**
+     * \brief Attach another image that is written as a layer of EXR files
+     *
+     * \param name
+     *     Name of the layer (its channels are called <tt>name.X</tt>, ..)
+     * \param view
+     *     Pixels of the layer (must have the same size)
+     * \param channels
+     *     One letter per channel that should be written, e.g. \c "RGB"
+     *     for colors or \c "Z" for the first component only
+     */
+    void addLayer(const std::string &name, const BitmapView &view,
+                  const std::string &channels = "RGB");
+
+    /// Save the image (along with its layers) as an EXR file with the specified filename
+    void saveEXR(const std::string &filename, const EXROptions &options = EXROptions()) const;
+
+    /// Save the image as a PNG file (with sRGB tonemapping) with the specified filename
+    void savePNG(const std::string &filename) const;
+protected:
+    friend class Bitmap;
+
+    const float *m_data;
+    Vector2i m_size;
+    size_t m_pixelStride, m_rowStride;
+    std::map<std::string, std::string> m_metadata;
+
+    struct Layer;
+    std::vector<Layer> m_layers;
+};
+
+/// Layer of a multi-layer EXR file (see \ref BitmapView::addLayer())
+struct BitmapView::Layer {
+    std::string name;
+    BitmapView view;
+    std::string channels;
+};
+
 /**
  * \brief Stores a RGB high dynamic-range bitmap
  *
@@ -44,11 +145,33 @@ public:
     /// Load an OpenEXR file with the specified filename
     Bitmap(const std::string &filename);
 
-    /// Save the bitmap as an EXR file with the specified filename
-    void saveEXR(const std::string &filename);
+    /// Attach a string attribute that is written to the header of EXR files
+    void setMetadata(const std::string &name, const std::string &value) {
+        m_metadata[name] = value;
+    }
+
+    /// Return a view of the bitmap (including its metadata)
+    BitmapView view() const;
+
+    /**
+     * \brief Save the bitmap as an EXR file with the specified filename
+     *
+     * The file is compressed in parallel by OpenEXR's global thread pool
+     * (see \ref setThreadCount()).
+     */
+    void saveEXR(const std::string &filename, const EXROptions &options = EXROptions()) {
+        view().saveEXR(filename, options);
+    }
 
     /// Save the bitmap as a PNG file (with sRGB tonemapping) with the specified filename
-    void savePNG(const std::string &filename);
+    void savePNG(const std::string &filename) {
+        view().savePNG(filename);
+    }
+
+    /// Set the number of threads that OpenEXR uses to compress and decompress files
+    static void setThreadCount(int threadCount);
+protected:
+    std::map<std::string, std::string> m_metadata;
 };
 
 NORI_NAMESPACE_END
@@ -24,7 +24,12 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
+#include <nori/bbox.h>
 #include <tbb/mutex.h>
+#include <tbb/spin_mutex.h>
+#include <atomic>
+#include <functional>
+#include <memory>
 
 #define NORI_BLOCK_SIZE 32 /* Block size used for parallelization */
 
@@ -82,23 +87,68 @@ public:
      */
     Bitmap *toBitmap() const;
 
+    /**
+     * \brief Normalize all pixels in place
+     *
+     * Afterwards, every pixel has a weight of one (or zero if it didn't
+     * receive any samples). Further samples can no longer be merged
+     * correctly, so this is meant for the final image: together with
+     * \ref getView(), it is written to disk without another full-size copy.
+     *
+     * \param transform
+     *     Optional function that is applied to every normalized pixel
+     *     (within the same parallel loop)
+     */
+    void normalize(const std::function<void (Color4f &)> &transform = nullptr);
+
+    /// Return a view of the pixels without the border region (call \ref normalize() first)
+    BitmapView getView() const;
+
     /// Convert a bitmap into an image block
     void fromBitmap(const Bitmap &bitmap);
 
     /// Clear all contents
     void clear() { setConstant(Color4f()); }
 
-    /// Record a sample with the given position and radiance value
+    /**
+     * \brief Record a sample with the given position and radiance value
+     *
+     * This function uses no scratch storage of the block, hence several
+     * threads may splat into the same block as long as the footprints
+     * of their samples do not overlap.
+     */
     void put(const Point2f &pos, const Color3f &value);
 
+    /**
+     * \brief Record a sample without checking that it is a valid radiance
+     * value (for auxiliary quantities such as normals, which can be negative)
+     */
+    void putUnchecked(const Point2f &pos, const Color3f &value);
+
     /**
      * \brief Merge another image block into this one
      *
      * During the merge operation, this function locks 
-     * the destination block using a mutex.
+     * the destination block using a mutex (unless striped
+     * locking was enabled via \ref setStripedLocking()).
      */
     void put(ImageBlock &b);
 
+    /**
+     * \brief Merge blocks without serializing them through a single mutex
+     *
+     * The blocks handed out by \ref BlockGenerator have disjoint interiors,
+     * and only a band of twice the border size around the edge of a block
+     * can receive contributions from neighboring blocks. When enabled,
+     * \ref put(ImageBlock &) adds the remaining pixels without any locking
+     * and resolves the overlapping band using one spin lock per row.
+     *
+     * Since \ref lock() no longer excludes concurrent merges in this mode,
+     * it should only be used when no other thread reads the image while
+     * rendering (i.e. without the preview window).
+     */
+    void setStripedLocking(bool value);
+
     /// Lock the image block (using an internal mutex)
     inline void lock() const { m_mutex.lock(); }
     
@@ -108,59 +158,166 @@ public:
     /// Return a human-readable string summary
     std::string toString() const;
 protected:
+    /// Signature of the kernels that splat a sample into the block
+    typedef void (ImageBlock::*SplatKernel)(const Point2f &pos, const Point2i &min,
+                                            const Color4f &value);
+
+    /// Look up the tabulated filter at the given distance from the sample
+    inline float filterWeight(float distance) const;
+
+    /**
+     * \brief Splat a sample whose footprint (of \c Size x \c Size pixels
+     * starting at \c min) lies completely within the block
+     *
+     * The loops have a fixed trip count, which lets the compiler unroll
+     * them and vectorize the accumulation of each row of the footprint.
+     */
+    template <int Size> void splat(const Point2f &pos, const Point2i &min,
+                                   const Color4f &value);
+
+    /// Splat a sample with an arbitrary footprint, clipped to the block
+    void splatGeneric(const Point2f &pos, const Color3f &value);
+
     Point2i m_offset;
     Vector2i m_size;
     int m_borderSize = 0;
     float *m_filter = nullptr;
     float m_filterRadius = 0;
-    float *m_weightsX = nullptr;
-    float *m_weightsY = nullptr;
     float m_lookupFactor = 0;
+    int m_footprint = 0;
+    bool m_box = false;
+    SplatKernel m_splat = nullptr;
     mutable tbb::mutex m_mutex;
+    std::unique_ptr<tbb::spin_mutex[]> m_rowLocks;
 };
 
 /**
- * \brief Spiraling block generator
+ * \brief Per-pixel sample statistics for adaptive sampling
+ *
+ * For every pixel of the image, this class records the number of samples
+ * taken so far along with the sum and the sum of squares of their luminance,
+ * from which the relative error of the pixel estimate can be computed.
+ *
+ * Samples are attributed to the pixel that contains them (i.e. they are not
+ * spread by the reconstruction filter). Blocks with disjoint interiors can
+ * therefore update the statistics concurrently without any locking.
+ */
+class SampleStatistics {
+public:
+    /// Create statistics for an image of the given size
+    SampleStatistics(const Vector2i &size);
+
+    /// Reset all pixels to zero samples
+    void clear() { m_data.setZero(); }
+
+    /// Record a sample of the given pixel
+    void put(const Point2i &pixel, const Color3f &value) {
+        double lum = (double) value.getLuminance();
+        auto entry = m_data.col(index(pixel));
+        entry += Eigen::Array3d(1.0, lum, lum * lum);
+    }
+
+    /// Return the number of samples recorded for the given pixel
+    uint32_t getSampleCount(const Point2i &pixel) const {
+        return (uint32_t) m_data(0, index(pixel));
+    }
+
+    /**
+     * \brief Return the standard error of the pixel's mean luminance
+     * relative to the mean itself (infinite with fewer than two samples)
+     */
+    float getRelativeError(const Point2i &pixel) const;
+
+    /// Return the size of the image
+    const Vector2i &getSize() const { return m_size; }
+
+    /// Return a pointer to the raw (count, sum, sum of squares) triplets
+    double *data() { return m_data.data(); }
+
+    /// Return a pointer to the raw (count, sum, sum of squares) triplets (const version)
+    const double *data() const { return m_data.data(); }
+protected:
+    int index(const Point2i &pixel) const {
+        return pixel.y() * m_size.x() + pixel.x();
+    }
+
+    Vector2i m_size;
+    Eigen::Array<double, 3, Eigen::Dynamic> m_data;
+};
+
+/**
+ * \brief Block generator
  *
  * This class can be used to chop up an image into many small
- * rectangular blocks suitable for parallel rendering. The blocks
- * are ordered in spiraling pattern so that the center is
+ * rectangular blocks suitable for parallel rendering. By default, the
+ * blocks are ordered in spiraling pattern so that the center is
  * rendered first.
+ *
+ * The order of the blocks is computed once in the constructor. Blocks are
+ * then handed out using a single atomic increment, hence any number of
+ * threads can request blocks without contending for a lock.
  */
 class BlockGenerator {
 public:
+    /// Order in which the blocks are handed out
+    enum EOrder {
+        /// Spiral starting in the center of the image
+        ESpiral = 0,
+        /// Hilbert curve (keeps consecutive blocks adjacent)
+        EHilbert,
+        /// Row by row, starting at the top left
+        EScanline
+    };
+
     /**
      * \brief Create a block generator with
      * \param size
      *      Size of the image that should be split into blocks
      * \param blockSize
      *      Maximum size of the individual blocks
+     * \param order
+     *      Order in which the blocks should be generated
+     * \param crop
+     *      Optional pixel rectangle (\c min inclusive, \c max exclusive).
+     *      Unless it is empty, only the blocks that overlap it are
+     *      generated, and they are clipped to it. Blocks stay on the
+     *      regular grid of the full image.
      */
-    BlockGenerator(const Vector2i &size, int blockSize);
+    BlockGenerator(const Vector2i &size, int blockSize, EOrder order = ESpiral,
+                   const BoundingBox2i &crop = BoundingBox2i());
     
     /**
      * \brief Return the next block to be rendered
      *
-     * This function is thread-safe
+     * This function is thread-safe and lock-free
      *
      * \return \c false if there were no more blocks
      */
     bool next(ImageBlock &block);
 
     /// Return the total number of blocks
-    int getBlockCount() const { return m_blocksLeft; }
+    int getBlockCount() const { return (int) m_blocks.size(); }
+
+    /// Parse the name of a block order ("spiral", "hilbert" or "scanline")
+    static EOrder parseOrder(const std::string &name);
 protected:
     enum EDirection { ERight = 0, EDown, ELeft, EUp };
 
-    Point2i m_block;
+    /// Append the blocks in a spiral pattern around the center
+    void generateSpiral();
+
+    /// Append the blocks along a Hilbert curve
+    void generateHilbert();
+
+    /// Append the blocks in scanline order
+    void generateScanline();
+
+    std::vector<Point2i> m_blocks;
     Vector2i m_numBlocks;
     Vector2i m_size;
+    BoundingBox2i m_crop;
     int m_blockSize;
-    int m_numSteps;
-    int m_blocksLeft;
-    int m_stepsLeft;
-    int m_direction;
-    tbb::mutex m_mutex;
+    std::atomic<int> m_next;
 };
 
 NORI_NAMESPACE_END
@@ -110,6 +110,13 @@ public:
      * or not to store photons on a surface
      */
     virtual bool isDiffuse() const { return false; }
+
+    /**
+     * \brief Return the fraction of the incident light that the surface
+     * reflects (or transmits), e.g. for the albedo AOV. Specular surfaces
+     * that don't absorb any light return one.
+     */
+    virtual Color3f getAlbedo() const { return Color3f(1.0f); }
 };
 
 NORI_NAMESPACE_END
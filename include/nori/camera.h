@@ -19,6 +19,7 @@
 #pragma once
 
 #include <nori/object.h>
+#include <nori/bbox.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -60,6 +61,17 @@ public:
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
+    /**
+     * \brief Return the part of the image that should be rendered
+     *
+     * Given in pixels (\c min inclusive, \c max exclusive). Covers the
+     * entire image unless a crop window was specified.
+     */
+    const BoundingBox2i &getCropWindow() const { return m_cropWindow; }
+
+    /// Return the horizontal field of view in degrees (zero if the camera has none)
+    virtual float getFov() const { return 0.0f; }
+
     /// Return the camera's reconstruction filter in image space
     const ReconstructionFilter *getReconstructionFilter() const { return m_rfilter; }
 
@@ -70,6 +82,7 @@ public:
     EClassType getClassType() const { return ECamera; }
 protected:
     Vector2i m_outputSize;
+    BoundingBox2i m_cropWindow;
     ReconstructionFilter *m_rfilter;
 };
 
@@ -0,0 +1,72 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+#include <nori/bbox.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Progress of a multi-pass render
+ *
+ * Samplers are reseeded from the pixel position and pass index at the
+ * beginning of every block (see \ref Sampler::prepare()), so the number of
+ * completed passes fully determines the sampler state at a pass boundary.
+ */
+struct RenderProgress {
+    /// Total number of samples per pixel
+    uint32_t sampleCount = 0;
+    /// Number of samples per pixel taken by each pass
+    uint32_t passSampleCount = 0;
+    /// Number of passes that have been completed
+    uint32_t passesDone = 0;
+    /// Number of samples per pixel taken by the completed passes
+    uint32_t samplesPerPixel = 0;
+    /// Wall-clock time spent rendering so far (in milliseconds)
+    double elapsed = 0;
+};
+
+/**
+ * \brief Write a render checkpoint to a binary file
+ *
+ * The checkpoint holds the progress counters, the crop window that is being
+ * rendered, the unnormalized contents of the accumulation block (including
+ * its border and filter weights), and the adaptive sampling statistics when
+ * given. The file is first written under a temporary name and then
+ * renamed, so that a crash never leaves behind a truncated checkpoint.
+ */
+extern void saveCheckpoint(const std::string &filename, const RenderProgress &progress,
+                           const BoundingBox2i &crop, const ImageBlock &result,
+                           const SampleStatistics *stats);
+
+/**
+ * \brief Restore a render checkpoint written by \ref saveCheckpoint()
+ *
+ * The image size, crop window, pass layout and the presence of adaptive
+ * sampling statistics must match those of \c result, \c crop, \c stats and
+ * the sample counts in \c progress. Otherwise, an exception is thrown.
+ *
+ * \return \c false if the file does not exist
+ */
+extern bool loadCheckpoint(const std::string &filename, RenderProgress &progress,
+                           const BoundingBox2i &crop, ImageBlock &result,
+                           SampleStatistics *stats);
+
+NORI_NAMESPACE_END
@@ -119,10 +119,12 @@ typedef TRay<Point3f, Vector3f> Ray3f;
 /// Some more forward declarations
 class BSDF;
 class Bitmap;
+class BitmapView;
 class BlockGenerator;
 class Camera;
 class ImageBlock;
 class Integrator;
+struct Intersection;
 class KDTree;
 class Emitter;
 struct EmitterQueryRecord;
@@ -0,0 +1,81 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/aov.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Parameters of \ref denoise()
+struct DenoiserOptions {
+    /// Radius of the filter window in pixels
+    int radius = 7;
+
+    /// Standard deviation of the spatial Gaussian (in pixels)
+    float sigmaSpatial = 4.0f;
+
+    /**
+     * \brief Tolerated color difference between two pixels, in multiples
+     * of the standard deviation of their estimates
+     */
+    float sigmaColor = 2.0f;
+
+    /// Standard deviation of the albedo difference
+    float sigmaAlbedo = 0.1f;
+
+    /// Standard deviation of the difference of the (unit) shading normals
+    float sigmaNormal = 0.2f;
+
+    /// Standard deviation of the depth difference relative to the depth
+    float sigmaDepth = 0.05f;
+
+    /// Return a human-readable string summary
+    std::string toString() const;
+};
+
+/// AOVs that must be rendered for \ref denoise() (the depth is optional)
+#define NORI_DENOISER_AOVS ((1u << EAlbedo) | (1u << ENormal) | (1u << EVariance))
+
+/**
+ * \brief Remove the Monte Carlo noise from a rendered image
+ *
+ * This is a joint (cross) bilateral filter: each output pixel is a weighted
+ * average of its neighborhood, where neighbors only receive a large weight
+ * when their albedo, shading normal and depth (if rendered) resemble those
+ * of the center pixel. Edges and texture in these noise-free guides are
+ * hence preserved. The color difference is measured relative to the
+ * standard error of the two pixels (the variance AOV divided by the sample
+ * count), so that the filter smooths noisy regions more aggressively than
+ * converged ones. Rows are filtered in parallel.
+ *
+ * \param beauty
+ *     Normalized image
+ * \param aovs
+ *     Normalized AOVs of the same render (see \ref NORI_DENOISER_AOVS)
+ * \param sampleCount
+ *     Number of samples per pixel
+ * \param stats
+ *     Per-pixel sample counts of adaptive sampling. When given, they
+ *     replace \c sampleCount.
+ */
+extern Bitmap *denoise(const BitmapView &beauty, const AOVBuffer &aovs,
+                       uint32_t sampleCount, const SampleStatistics *stats = nullptr,
+                       const DenoiserOptions &options = DenoiserOptions());
+
+NORI_NAMESPACE_END
@@ -0,0 +1,119 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <nori/block.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Distributes the blocks of a render over worker processes
+ *
+ * The coordinator listens on a TCP port. Worker processes (started with
+ * \c --connect) load the same scene, open one connection per rendering
+ * thread and then repeatedly receive a block along with a pass index,
+ * render it and send back the unnormalized block contents, which are
+ * merged into the output image.
+ *
+ * Samplers are seeded from the pixel position and the pass index (see
+ * \ref Sampler::prepare()), so a block rendered by a worker is bit-identical
+ * to the same block rendered locally. The blocks of a pass are merged into
+ * a separate image block in the order of the block generator, regardless of
+ * when they arrive. Each pass therefore matches the same pass rendered
+ * locally by a single thread bit for bit. (A multi-threaded local render
+ * sums the border pixels of its blocks in arbitrary order.) Blocks of
+ * workers that disconnect are handed to the remaining ones.
+ */
+class RenderCoordinator {
+public:
+    /// One unit of work that is sent to a worker
+    struct Task {
+        uint32_t type, index;
+        uint32_t pass, sampleCount;
+        int32_t offsetX, offsetY, sizeX, sizeY;
+    };
+
+    /**
+     * \brief Start listening for workers
+     * \param port
+     *      TCP port to listen on
+     * \param scene
+     *      Scene that is rendered. Workers must report the same image size,
+     *      sample count and reconstruction filter size
+     */
+    RenderCoordinator(int port, const Scene *scene);
+
+    /// Send all workers home and close the connections
+    ~RenderCoordinator();
+
+    /**
+     * \brief Render one pass over the image using the connected workers
+     *
+     * Blocks are taken from \c generator and accumulated in a block of the
+     * coordinator, which is only merged into \c result once the pass is
+     * complete. If \c abort becomes true, no further blocks are handed out
+     * and the function returns once the blocks in flight have been
+     * received. The same happens when \c stop becomes true while no worker
+     * is connected, since nobody could finish the pass then.
+     *
+     * \return \c false if the pass was abandoned before all of its blocks
+     *     were rendered. \c result is left untouched in that case.
+     */
+    bool renderPass(BlockGenerator &generator, uint32_t pass, uint32_t sampleCount,
+                    ImageBlock &result, const std::atomic<bool> &abort,
+                    const std::atomic<bool> &stop);
+
+    /// Return the number of connected worker threads
+    int getWorkerCount() const { return m_workerCount; }
+protected:
+    /// Accept incoming connections until the coordinator shuts down
+    void acceptWorkers();
+
+    /// Hand out tasks to a single worker connection
+    void serveWorker(intptr_t socket);
+
+    const Scene *m_scene;
+    intptr_t m_listener;
+    std::thread m_acceptThread;
+    std::vector<std::thread> m_workerThreads;
+    std::atomic<int> m_workerCount;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Task> m_tasks;
+    size_t m_pending = 0;
+    ImageBlock *m_result = nullptr;
+    std::unique_ptr<ImageBlock> m_passResult;
+    std::vector<std::unique_ptr<ImageBlock>> m_received;
+    size_t m_nextMerge = 0;
+    bool m_shutdown = false;
+};
+
+/**
+ * \brief Render blocks for a coordinator until it has no more work
+ *
+ * Opens \c threadCount connections to the coordinator at \c address
+ * (given as \c host:port), each of which renders one block at a time.
+ */
+extern void runWorker(Scene *scene, const std::string &address, int threadCount);
+
+NORI_NAMESPACE_END
@@ -53,6 +53,40 @@ public:
      */
     virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const = 0;
 
+    /// Does the integrator implement the breadth-first \ref shade() interface?
+    virtual bool isWavefront() const { return false; }
+
+    /**
+     * \brief Breadth-first counterpart of \ref Li() used by the wavefront renderer
+     *
+     * The camera ray has already been intersected with the scene. Instead of
+     * tracing an occlusion ray itself, the integrator may return it along
+     * with the contribution that is added to \c value if the ray turns out
+     * to be unoccluded. The wavefront renderer traces these rays in bulk.
+     *
+     * \param scene
+     *    A pointer to the underlying scene
+     * \param sampler
+     *    A pointer to a sample generator
+     * \param ray
+     *    The camera ray
+     * \param its
+     *    Its intersection, or \c nullptr if the ray escaped
+     * \param value
+     *    Returns the radiance that does not depend on an occlusion test
+     * \param shadowRay
+     *    Returns the occlusion ray (if any)
+     * \param shadowValue
+     *    Returns the radiance that is added when \c shadowRay is unoccluded
+     * \return
+     *    \c true if an occlusion ray was generated
+     */
+    virtual bool shade(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                       const Intersection *its, Color3f &value, Ray3f &shadowRay,
+                       Color3f &shadowValue) const {
+        throw NoriException("Integrator::shade(): the wavefront interface is not implemented!");
+    }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.) 
      * provided by this instance
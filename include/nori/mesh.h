@@ -21,9 +21,13 @@
 #include <nori/object.h>
 #include <nori/frame.h>
 #include <nori/bbox.h>
+#include <nori/dpdf.h>
+#include <memory>
 
 NORI_NAMESPACE_BEGIN
 
+struct OctreeNode;
+
 /**
  * \brief Intersection data structure
  *
@@ -63,6 +67,24 @@ struct Intersection {
     std::string toString() const;
 };
 
+/**
+ * \brief Vertex and index buffers of a triangle mesh
+ *
+ * Meshes that were loaded from the same file using the same transformation
+ * reference a single (reference-counted) instance of this data structure
+ * instead of storing their own copy.
+ */
+struct MeshGeometry {
+    MatrixXf      V;                     ///< Vertex positions
+    MatrixXf      N;                     ///< Vertex normals
+    MatrixXf      UV;                    ///< Vertex texture coordinates
+    MatrixXu      F;                     ///< Faces
+    BoundingBox3f bbox;                  ///< Bounding box of the mesh
+    DiscretePDF   areaPDF;               ///< Distribution of triangle areas
+    std::shared_ptr<OctreeNode> octree;  ///< Octree over \c F (built by \ref Accel)
+    bool          reordered = false;     ///< Were the buffers sorted for locality?
+};
+
 /**
  * \brief Triangle mesh
  *
@@ -80,16 +102,16 @@ public:
     virtual void activate();
 
     /// Return the total number of triangles in this shape
-    uint32_t getTriangleCount() const { return (uint32_t) m_F.cols(); }
+    uint32_t getTriangleCount() const { return (uint32_t) m_geometry->F.cols(); }
 
     /// Return the total number of vertices in this shape
-    uint32_t getVertexCount() const { return (uint32_t) m_V.cols(); }
+    uint32_t getVertexCount() const { return (uint32_t) m_geometry->V.cols(); }
 
     /// Return the surface area of the given triangle
     float surfaceArea(uint32_t index) const;
 
     //// Return an axis-aligned bounding box of the entire mesh
-    const BoundingBox3f &getBoundingBox() const { return m_bbox; }
+    const BoundingBox3f &getBoundingBox() const { return m_geometry->bbox; }
 
     //// Return an axis-aligned bounding box containing the given triangle
     BoundingBox3f getBoundingBox(uint32_t index) const;
@@ -97,6 +119,23 @@ public:
     //// Return the centroid of the given triangle
     Point3f getCentroid(uint32_t index) const;
 
+    /**
+     * \brief Uniformly sample a position on the surface of the mesh
+     *
+     * A triangle is chosen proportional to its area using the table that
+     * is built by \ref activate(), followed by a uniform position on it.
+     *
+     * \param sample
+     *    A uniformly distributed sample on <tt>[0,1]^2</tt>
+     * \param p
+     *    The sampled position
+     * \param n
+     *    The surface normal at \c p (interpolated if the mesh has vertex normals)
+     * \param pdf
+     *    Density of the sampled position with respect to surface area
+     */
+    void samplePosition(const Point2f &sample, Point3f &p, Normal3f &n, float &pdf) const;
+
     /** \brief Ray-triangle intersection test
      *
      * Uses the algorithm by Moeller and Trumbore discussed at
@@ -125,16 +164,19 @@ public:
     bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const;
 
     /// Return a pointer to the vertex positions
-    const MatrixXf &getVertexPositions() const { return m_V; }
+    const MatrixXf &getVertexPositions() const { return m_geometry->V; }
 
     /// Return a pointer to the vertex normals (or \c nullptr if there are none)
-    const MatrixXf &getVertexNormals() const { return m_N; }
+    const MatrixXf &getVertexNormals() const { return m_geometry->N; }
 
     /// Return a pointer to the texture coordinates (or \c nullptr if there are none)
-    const MatrixXf &getVertexTexCoords() const { return m_UV; }
+    const MatrixXf &getVertexTexCoords() const { return m_geometry->UV; }
 
     /// Return a pointer to the triangle vertex index list
-    const MatrixXu &getIndices() const { return m_F; }
+    const MatrixXu &getIndices() const { return m_geometry->F; }
+
+    /// Return the (possibly shared) vertex and index buffers of this mesh
+    const std::shared_ptr<MeshGeometry> &getGeometry() const { return m_geometry; }
 
     /// Is this mesh an area emitter?
     bool isEmitter() const { return m_emitter != nullptr; }
@@ -167,15 +209,22 @@ protected:
     /// Create an empty mesh
     Mesh();
 
+    /**
+     * \brief Reorder the triangles and vertices for memory locality
+     *
+     * Triangles are sorted along a Morton (Z-order) curve through their
+     * centroids, after which vertices are renumbered in order of their
+     * first use. Spatially adjacent triangles then also tend to be adjacent
+     * in the index and vertex buffers.
+     */
+    void reorder();
+
 protected:
     std::string m_name;                  ///< Identifying name
-    MatrixXf      m_V;                   ///< Vertex positions
-    MatrixXf      m_N;                   ///< Vertex normals
-    MatrixXf      m_UV;                  ///< Vertex texture coordinates
-    MatrixXu      m_F;                   ///< Faces
+    std::shared_ptr<MeshGeometry> m_geometry; ///< Vertex and index buffers
     BSDF         *m_bsdf = nullptr;      ///< BSDF of the surface
     Emitter    *m_emitter = nullptr;     ///< Associated emitter, if any
-    BoundingBox3f m_bbox;                ///< Bounding box of the mesh
+    bool          m_reorder = false;     ///< Reorder the geometry in \ref activate()?
 };
 
 NORI_NAMESPACE_END
@@ -19,6 +19,8 @@
 #pragma once
 
 #include <nori/proplist.h>
+#include <unordered_map>
+#include <functional>
 
 NORI_NAMESPACE_BEGIN
 
@@ -141,12 +143,15 @@ public:
      */
     static NoriObject *createInstance(const std::string &name,
             const PropertyList &propList) {
-        if (!m_constructors || m_constructors->find(name) == m_constructors->end())
-            throw NoriException("A constructor for class \"%s\" could not be found!", name);
-        return (*m_constructors)[name](propList);
+        if (m_constructors) {
+            auto it = m_constructors->find(name);
+            if (it != m_constructors->end())
+                return it->second(propList);
+        }
+        throw NoriException("A constructor for class \"%s\" could not be found!", name);
     }
 private:
-    static std::map<std::string, Constructor> *m_constructors;
+    static std::unordered_map<std::string, Constructor> *m_constructors;
 };
 
 /// Macro for registering an object constructor with the \ref NoriObjectFactory
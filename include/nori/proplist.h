@@ -20,7 +20,6 @@
 
 #include <nori/color.h>
 #include <nori/transform.h>
-#include <map>
 
 NORI_NAMESPACE_BEGIN
 
@@ -131,7 +130,23 @@ private:
         Property() : type(boolean_type) { }
     };
 
-    std::map<std::string, Property> m_properties;
+    /// A named property (the hash of the name is stored to speed up lookups)
+    struct Entry {
+        size_t hash;
+        std::string name;
+        Property property;
+    };
+
+    /// Return the property of the given name, or \c nullptr if there is none
+    const Property *find(const std::string &name) const;
+
+    /// Return the property of the given name, creating it if necessary
+    Property &insert(const std::string &name);
+
+    /* Objects only have a handful of properties. A linear scan over a
+       contiguous array that compares hashes before names is considerably
+       faster than a tree of heap-allocated nodes */
+    std::vector<Entry> m_properties;
 };
 
 NORI_NAMESPACE_END
@@ -0,0 +1,48 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <nori/block.h>
+#include <nori/aov.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Render one pass over an image block
+ *
+ * Every pixel receives \c sampleCount samples. When adaptive sampling
+ * statistics are provided, pixels that have reached the sampler's minimum
+ * sample count and error threshold are skipped, and no pixel exceeds the
+ * sampler's total sample count.
+ *
+ * The sampler must have been prepared for the block beforehand (see
+ * \ref Sampler::prepare()). Camera rays are generated by \c camera when
+ * given, and by the scene's camera otherwise.
+ *
+ * When \c aovs is given, it is moved to the block and receives the AOVs of
+ * every camera ray. It must have been prepared like the sampler (see
+ * \ref AOVBuffer::prepare()). The camera ray is only intersected once if the
+ * integrator implements \ref Integrator::shade().
+ *
+ * \return The number of samples that were taken
+ */
+extern size_t renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block,
+                          uint32_t sampleCount, SampleStatistics *stats = nullptr,
+                          const Camera *camera = nullptr, AOVBuffer *aovs = nullptr);
+
+NORI_NAMESPACE_END
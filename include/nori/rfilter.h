@@ -23,6 +23,9 @@
 /// Reconstruction filters will be tabulated at this resolution
 #define NORI_FILTER_RESOLUTION 32
 
+/// Largest supported filter radius (bounds the footprint of a sample in pixels)
+#define NORI_MAX_FILTER_RADIUS 4
+
 NORI_NAMESPACE_BEGIN
 
 /**
@@ -45,6 +48,15 @@ public:
     /// Evaluate the filter function
     virtual float eval(float x) const = 0;
 
+    /**
+     * \brief Is this a box filter?
+     *
+     * Such a filter attributes each sample to the pixel containing it with
+     * a constant weight, which lets \ref ImageBlock skip the tabulation
+     * and the border region entirely.
+     */
+    virtual bool isBox() const { return false; }
+
     /**
      * \brief Return the type of object (i.e. Mesh/Camera/etc.) 
      * provided by this instance
@@ -74,8 +74,15 @@ public:
      * a new image block. This can be used to deterministically
      * initialize the sampler so that repeated program runs
      * always create the same image.
+     *
+     * \param block
+     *     The image block that is about to be rendered
+     * \param pass
+     *     Index of the pass over the image (progressive rendering
+     *     visits each block several times, and each visit should
+     *     use different samples)
      */
-    virtual void prepare(const ImageBlock &block) = 0;
+    virtual void prepare(const ImageBlock &block, uint32_t pass) = 0;
 
     /**
      * \brief Prepare to generate new samples
@@ -97,6 +104,23 @@ public:
     /// Return the number of configured pixel samples
     virtual size_t getSampleCount() const { return m_sampleCount; }
 
+    /**
+     * \brief Return the number of samples that every pixel receives
+     * before adaptive sampling may stop sampling it
+     */
+    size_t getMinSampleCount() const { return m_minSampleCount; }
+
+    /**
+     * \brief Return the relative standard error at which adaptive sampling
+     * considers a pixel converged (0 if adaptive sampling is disabled)
+     */
+    float getErrorThreshold() const { return m_errorThreshold; }
+
+    /// Is adaptive sampling enabled?
+    bool isAdaptive() const {
+        return m_errorThreshold > 0 && m_minSampleCount < m_sampleCount;
+    }
+
     /**
      * \brief Return the type of object (i.e. Mesh/Sampler/etc.) 
      * provided by this instance
@@ -104,6 +128,8 @@ public:
     EClassType getClassType() const { return ESampler; }
 protected:
     size_t m_sampleCount;
+    size_t m_minSampleCount = 0;
+    float m_errorThreshold = 0.f;
 };
 
 NORI_NAMESPACE_END
@@ -58,6 +58,14 @@ public:
     /// Return a reference to an array containing all meshes
     const std::vector<Mesh *> &getMeshes() const { return m_meshes; }
 
+    /**
+     * \brief Return the wall-clock budget for rendering the scene in seconds
+     *
+     * When nonzero, progressive passes are rendered until the budget is
+     * used up. Can be overridden using the \c --time-limit argument.
+     */
+    float getTimeLimit() const { return m_timeLimit; }
+
     /**
      * \brief Intersect a ray against all triangles stored in the scene
      * and return detailed intersection information
@@ -122,6 +130,7 @@ private:
     Sampler *m_sampler = nullptr;
     Camera *m_camera = nullptr;
     Accel *m_accel = nullptr;
+    float m_timeLimit = 0.f;
 };
 
 NORI_NAMESPACE_END
@@ -0,0 +1,50 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <nori/common.h>
+#include <iosfwd>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Serve render jobs until the input ends or a "quit" job arrives
+ *
+ * Jobs are JSON objects, one per line of \c in. Responses are written to
+ * \c out as JSON objects, again one per line:
+ *
+ * <tt>{"type": "render", "id": 1, "scene": "cbox.xml", "spp": 16,
+ *  "roi": [x, y, width, height], "output": "cbox-job1",
+ *  "camera": {"origin": [..], "target": [..], "up": [..], "fov": 30}}</tt>
+ *      Renders a scene. Only \c scene is required. Scenes stay loaded
+ *      between jobs (\c "reload": true forces a reload). Every finished
+ *      block is sent back as a \c "tile" message with its normalized RGB
+ *      values, followed by a \c "done" message. The exact merged image is
+ *      written to \c output (EXR and PNG) when given.
+ *
+ * <tt>{"type": "unload", "scene": "cbox.xml"}</tt>
+ *      Releases a resident scene.
+ *
+ * <tt>{"type": "quit"}</tt>
+ *      Stops the server.
+ *
+ * Failed jobs are answered with an \c "error" message.
+ */
+extern void runServer(std::istream &in, std::ostream &out);
+
+NORI_NAMESPACE_END
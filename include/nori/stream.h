@@ -0,0 +1,97 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <nori/bitmap.h>
+#include <nori/block.h>
+#include <tbb/mutex.h>
+#include <map>
+#include <vector>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Writes a tiled OpenEXR file while the image is being rendered
+ *
+ * Instead of accumulating the entire frame, finished image blocks are merged
+ * into buffers that each cover one row of tiles (i.e. \ref NORI_BLOCK_SIZE
+ * scanlines). Since the filter footprint of a block only extends into the
+ * neighboring rows, a row can no longer change once all blocks of the row
+ * itself and of the rows above and below it have been merged. It is then
+ * normalized, written to disk and released.
+ *
+ * When the blocks arrive roughly in scanline order, only a few rows of
+ * tiles are resident at any time, independently of the image height.
+ */
+class TileStream {
+public:
+    /**
+     * \brief Create the output file
+     *
+     * \param filename
+     *     Name of the EXR file (without extension)
+     * \param size
+     *     Size of the image
+     * \param filter
+     *     Reconstruction filter of the blocks that will be merged
+     * \param options
+     *     Storage format of the file (the tile size is always \ref NORI_BLOCK_SIZE)
+     * \param metadata
+     *     String attributes of the header. The header is written before the
+     *     first tile, so these must be known up front (unlike the render time).
+     */
+    TileStream(const std::string &filename, const Vector2i &size,
+               const ReconstructionFilter *filter, const EXROptions &options,
+               const std::map<std::string, std::string> &metadata);
+
+    /// Release all memory (rows that were not written yet are lost)
+    ~TileStream();
+
+    /**
+     * \brief Merge a finished image block
+     *
+     * Blocks must lie on the grid used by \ref BlockGenerator, and each of
+     * them must be merged exactly once. This function is thread-safe and
+     * writes all rows of tiles that are complete afterwards.
+     */
+    void put(ImageBlock &block);
+
+    /// Write the remaining rows of tiles, even if some of their blocks are missing
+    void finish();
+
+    /// Return the largest number of rows of tiles that were resident at the same time
+    int getPeakRowCount() const { return m_peakRows; }
+protected:
+    typedef Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Row;
+
+    /// Normalize a row of tiles, write it to disk and release it
+    void writeRow(int index);
+
+    struct EXRFile;
+    std::unique_ptr<EXRFile> m_file;
+    Vector2i m_size;
+    Vector2i m_numBlocks;
+    int m_borderSize;
+    std::vector<std::unique_ptr<Row>> m_rows;
+    std::vector<int> m_pendingBlocks;
+    std::vector<bool> m_written;
+    int m_residentRows = 0, m_peakRows = 0;
+    tbb::mutex m_mutex;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,103 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <nori/mesh.h>
+#include <pcg32.h>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/// Maximum number of paths that the wavefront renderer keeps in flight
+#define NORI_WAVEFRONT_SIZE (1 << 18)
+
+/**
+ * \brief Breadth-first (wavefront) renderer
+ *
+ * Instead of computing one sample at a time from start to finish, this
+ * renderer processes a large batch of samples stage by stage. Each stage is
+ * a \c tbb::parallel_for over a queue of path states stored as a structure
+ * of arrays:
+ *
+ * 1. \a generate: sample camera rays for all pixel samples of a group of blocks
+ * 2. \a intersect: find the closest intersection of all camera rays
+ * 3. \a shade: sort the hits by BSDF and let the integrator shade them
+ *    (see \ref Integrator::shade()), which may emit occlusion rays
+ * 4. \a shadow: trace the compacted queue of occlusion rays
+ * 5. \a accumulate: splat the samples into the output image block by block
+ *
+ * Every sample owns its random number generator. Its index in the image
+ * selects the stream, and a hash of the index and the pass index gives the
+ * initial state. The result therefore doesn't depend on the number of
+ * threads or on how the stages are scheduled.
+ */
+class WavefrontRenderer {
+public:
+    /// Prepare to render the given scene, whose integrator must support \ref Integrator::shade()
+    WavefrontRenderer(const Scene *scene);
+
+    /**
+     * \brief Render one pass over the image
+     *
+     * Takes \c sampleCount samples in every pixel of the blocks handed out
+     * by \c generator and merges them into \c result. Stops early when
+     * \c abort becomes true.
+     */
+    void renderPass(BlockGenerator &generator, uint32_t pass, uint32_t sampleCount,
+                    ImageBlock &result, const std::atomic<bool> &abort);
+protected:
+    /// A block along with the range of its samples in the queue
+    struct WaveBlock {
+        Point2i offset;
+        Vector2i size;
+        uint32_t start;
+    };
+
+    void generate(uint32_t pass, uint32_t sampleCount);
+    void intersect();
+    void shade();
+    void traceShadowRays();
+    void accumulate(ImageBlock &result);
+
+    /// Create a ray from the structure-of-arrays storage
+    Ray3f getRay(uint32_t i) const;
+
+    const Scene *m_scene;
+    std::vector<WaveBlock> m_blocks;
+    uint32_t m_pathCount = 0;
+
+    /* Per-sample state (structure of arrays) */
+    std::vector<float> m_pixelX, m_pixelY;
+    std::vector<float> m_originX, m_originY, m_originZ;
+    std::vector<float> m_dirX, m_dirY, m_dirZ;
+    std::vector<Color3f> m_weight, m_radiance;
+    std::vector<pcg32> m_random;
+    std::vector<uint8_t> m_hit;
+    std::vector<Intersection> m_its;
+
+    /// Hit samples ordered by BSDF (BSDF, sample index)
+    std::vector<std::pair<const BSDF *, uint32_t>> m_shadeQueue;
+
+    /* Occlusion rays (structure of arrays), compacted after shading */
+    std::vector<uint8_t> m_hasShadowRay;
+    std::vector<Ray3f> m_shadowRay;
+    std::vector<Color3f> m_shadowValue;
+    std::vector<uint32_t> m_shadowQueue;
+};
+
+NORI_NAMESPACE_END
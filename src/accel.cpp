@@ -148,13 +148,23 @@ void Accel::addMesh(Mesh *mesh) {
 }
 
 void Accel::build() {
-    /* Nothing to do here for now */
+    /* The octree only depends on the mesh geometry. If another scene (e.g.
+       a previous version of a scene being reloaded) has already built one
+       for the same geometry, simply reuse it */
+    std::shared_ptr<OctreeNode> &octree = m_mesh->getGeometry()->octree;
+    if (octree) {
+        m_root = octree;
+        std::cout << "Octree reused" << std::endl;
+        return;
+    }
+
     std::vector<uint32_t> allTriangles;
     for(uint32_t i = 0; i< m_mesh->getTriangleCount(); ++i){
         allTriangles.push_back(i);
     }
     int maxDepth = 4;
-    m_root = buildRecursive(m_bbox, allTriangles,m_mesh, 0, maxDepth);
+    m_root.reset(buildRecursive(m_bbox, allTriangles,m_mesh, 0, maxDepth));
+    octree = m_root;
 
     std::cout << "Octree built" << std::endl;
 }
@@ -241,7 +251,9 @@ bool Accel::rayIntersect(const Ray3f &ray_, Intersection &its, bool shadowRay) c
         }
     }else{
         // 옥트리 빌드 된거면 옥트리 순회
-       rayIntersectNode(m_root, m_bbox, ray, its, shadowRay, foundIntersection, f, m_mesh);
+       bool hit = rayIntersectNode(m_root.get(), m_bbox, ray, its, shadowRay, foundIntersection, f, m_mesh);
+       // 그림자 광선은 교차 여부만 필요 (foundIntersection은 갱신되지 않음)
+       if(shadowRay) return hit;
     }
         
     if (foundIntersection) {
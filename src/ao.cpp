@@ -25,6 +25,18 @@ public:
 
         return Color3f(1.0f);
     }
+    bool isWavefront() const { return true; }
+    bool shade(const Scene* scene, Sampler* sampler, const Ray3f& ray, const Intersection* its,
+               Color3f& value, Ray3f& shadowRay, Color3f& shadowValue) const{
+        value = Color3f(0.0f);
+        if(!its) return false;
+
+        Frame standard(its->shFrame.n);
+        Vector3f localDir = Warp::squareToCosineHemisphere(sampler->next2D());
+        shadowRay = Ray3f(its->p, standard.toWorld(localDir));
+        shadowValue = Color3f(1.0f);
+        return true;
+    }
     std::string toString() const{
         return "AoIntegrator[]";
     }
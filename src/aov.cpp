@@ -0,0 +1,126 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/aov.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Layer names and the channels that are written for each AOV
+static const char *aovNames[EAOVCount] = { "albedo", "normal", "depth", "ao", "variance" };
+static const char *aovChannels[EAOVCount] = { "RGB", "XYZ", "Z", "Y", "Y" };
+
+AOVBuffer::AOVBuffer(uint32_t mask, const Vector2i &size, const ReconstructionFilter *filter)
+        : m_mask(mask) {
+    for (int i=0; i<EAOVCount; ++i) {
+        if (has((EAOV) i)) {
+            m_blocks[i].reset(new ImageBlock(size, filter));
+            m_blocks[i]->clear();
+        }
+    }
+}
+
+uint32_t AOVBuffer::parseAOVs(const std::string &names) {
+    uint32_t mask = 0;
+    for (const std::string &name : tokenize(names, ",")) {
+        int i = 0;
+        while (i < EAOVCount && toLower(name) != aovNames[i])
+            ++i;
+        if (i == EAOVCount)
+            throw NoriException("Unknown AOV \"%s\" (expected \"albedo\", \"normal\", "
+                                "\"depth\", \"ao\" or \"variance\")", name);
+        mask |= 1u << i;
+    }
+    return mask;
+}
+
+const char *AOVBuffer::getName(EAOV aov) {
+    return aovNames[aov];
+}
+
+void AOVBuffer::reset(const Point2i &offset, const Vector2i &size) {
+    for (int i=0; i<EAOVCount; ++i) {
+        if (m_blocks[i]) {
+            m_blocks[i]->setOffset(offset);
+            m_blocks[i]->setSize(size);
+            m_blocks[i]->clear();
+        }
+    }
+}
+
+void AOVBuffer::prepare(const ImageBlock &block, uint32_t pass) {
+    /* Bit 62 keeps the streams apart from those of the independent sampler */
+    m_random.seed(
+        block.getOffset().x(),
+        block.getOffset().y() + ((uint64_t) pass << 32) + (1ull << 62)
+    );
+}
+
+void AOVBuffer::put(const Point2f &pos, const AOVRecord &record) {
+    for (int i=0; i<EAOVCount; ++i) {
+        if (m_blocks[i])
+            m_blocks[i]->putUnchecked(pos, record.value[i]);
+    }
+}
+
+void AOVBuffer::put(AOVBuffer &buffer) {
+    if (buffer.getMask() != m_mask)
+        throw NoriException("AOVBuffer::put(): the AOVs don't match!");
+    for (int i=0; i<EAOVCount; ++i) {
+        if (m_blocks[i])
+            m_blocks[i]->put(*buffer.m_blocks[i]);
+    }
+}
+
+void AOVBuffer::setStripedLocking(bool value) {
+    for (int i=0; i<EAOVCount; ++i) {
+        if (m_blocks[i])
+            m_blocks[i]->setStripedLocking(value);
+    }
+}
+
+void AOVBuffer::normalize() {
+    for (int i=0; i<EAOVCount; ++i) {
+        if (!m_blocks[i])
+            continue;
+        if (i != EVariance) {
+            m_blocks[i]->normalize();
+            continue;
+        }
+
+        /* E[L^2] - E[L]^2 (stored in all channels like other scalar AOVs) */
+        m_blocks[i]->normalize([](Color4f &pixel) {
+            float variance = std::max(0.0f, pixel.y() - pixel.x() * pixel.x());
+            pixel << variance, variance, variance, pixel.w();
+        });
+    }
+}
+
+BitmapView AOVBuffer::getView(EAOV aov) const {
+    if (!m_blocks[aov])
+        throw NoriException("AOVBuffer::getView(): the AOV \"%s\" is not enabled!", aovNames[aov]);
+    return m_blocks[aov]->getView();
+}
+
+void AOVBuffer::addLayers(BitmapView &view) const {
+    for (int i=0; i<EAOVCount; ++i) {
+        if (m_blocks[i])
+            view.addLayer(aovNames[i], m_blocks[i]->getView(), aovChannels[i]);
+    }
+}
+
+NORI_NAMESPACE_END
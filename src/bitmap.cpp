@@ -19,12 +19,25 @@
 #include <nori/bitmap.h>
 #include <ImfInputFile.h>
 #include <ImfOutputFile.h>
+#include <ImfTiledOutputFile.h>
+#include <ImfThreading.h>
 #include <ImfChannelList.h>
 #include <ImfStringAttribute.h>
 #include <ImfVersion.h>
 #include <ImfIO.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <zlib.h>
+#include <atomic>
+#include <cstdlib>
 #include <ctime>
 
+NORI_NAMESPACE_BEGIN
+static unsigned char *deflateParallel(unsigned char *data, int size, int *outSize, int quality);
+NORI_NAMESPACE_END
+
+/* Let stb_image_write hand the filtered scanlines to the parallel compressor below */
+#define STBIW_ZLIB_COMPRESS nori::deflateParallel
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 
@@ -79,60 +92,248 @@ Bitmap::Bitmap(const std::string &filename) {
     file.readPixels(dw.min.y, dw.max.y);
 }
 
-void Bitmap::saveEXR(const std::string &filename) {
-    cout << "Writing a " << cols() << "x" << rows()
-         << " OpenEXR file to \"" << filename << "\"" << endl;
+static const char *compressionNames[] = {
+    "none", "rle", "zips", "zip", "piz", "pxr24", "b44", "b44a", "dwaa", "dwab"
+};
+
+EXROptions::ECompression EXROptions::parseCompression(const std::string &name) {
+    std::string value = toLower(name);
+    for (int i=0; i<(int) (sizeof(compressionNames) / sizeof(compressionNames[0])); ++i) {
+        if (value == compressionNames[i])
+            return (ECompression) i;
+    }
+    throw NoriException("Unknown EXR compression \"%s\" (expected \"none\", \"rle\", "
+        "\"zips\", \"zip\", \"piz\", \"pxr24\", \"b44\", \"b44a\", \"dwaa\" or \"dwab\")", name);
+}
+
+std::string EXROptions::toString() const {
+    return tfm::format("%s, %s, %s", half ? "half" : "float",
+        tileSize > 0 ? tfm::format("%ix%i tiles", tileSize, tileSize) : std::string("scanlines"),
+        compressionNames[compression]);
+}
+
+BitmapView Bitmap::view() const {
+    BitmapView view(data()->data(), Vector2i((int) cols(), (int) rows()), 3, 3 * cols());
+    view.m_metadata = m_metadata;
+    return view;
+}
+
+void BitmapView::addLayer(const std::string &name, const BitmapView &view,
+                          const std::string &channels) {
+    if (view.getSize() != m_size)
+        throw NoriException("BitmapView::addLayer(): layer \"%s\" has a different size!", name);
+    if (channels.empty() || channels.size() > 3)
+        throw NoriException("BitmapView::addLayer(): layer \"%s\" must have 1-3 channels!", name);
+    m_layers.push_back(Layer { name, view, channels });
+}
+
+void BitmapView::saveEXR(const std::string &filename, const EXROptions &options) const {
+    cout << "Writing a " << m_size.x() << "x" << m_size.y()
+         << " OpenEXR file (" << options.toString();
+    if (!m_layers.empty())
+        cout << ", " << m_layers.size() + 1 << " layers";
+    cout << ") to \"" << filename << "\"" << endl;
 
     std::string path = filename + ".exr";
 
-    Imf::Header header((int) cols(), (int) rows());
+    Imf::Header header(m_size.x(), m_size.y());
     header.insert("comments", Imf::StringAttribute("Generated by Nori"));
     header.insert("id", Imf::StringAttribute(std::to_string(std::time(nullptr))));
+    for (const auto &attr : m_metadata)
+        header.insert(attr.first, Imf::StringAttribute(attr.second));
+
+    header.compression() = (Imf::Compression) options.compression;
 
+    /* OpenEXR converts the float slices below when the channels are stored as halfs */
+    Imf::PixelType type = options.half ? Imf::HALF : Imf::FLOAT;
     Imf::ChannelList &channels = header.channels();
-    channels.insert("R", Imf::Channel(Imf::FLOAT));
-    channels.insert("G", Imf::Channel(Imf::FLOAT));
-    channels.insert("B", Imf::Channel(Imf::FLOAT));
+    channels.insert("R", Imf::Channel(type));
+    channels.insert("G", Imf::Channel(type));
+    channels.insert("B", Imf::Channel(type));
 
     Imf::FrameBuffer frameBuffer;
     size_t compStride = sizeof(float),
-           pixelStride = 3 * compStride,
-           rowStride = pixelStride * cols();
+           pixelStride = m_pixelStride * compStride,
+           rowStride = m_rowStride * compStride;
 
-    char *ptr = reinterpret_cast<char *>(data());
+    /* OpenEXR only reads from the frame buffer when writing */
+    char *ptr = reinterpret_cast<char *>(const_cast<float *>(m_data));
     frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
     frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
     frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
 
-    Imf::OutputFile file(path.c_str(), header);
-    file.setFrameBuffer(frameBuffer);
-    file.writePixels((int) rows());
+    for (const Layer &layer : m_layers) {
+        char *base = reinterpret_cast<char *>(const_cast<float *>(layer.view.m_data));
+        for (size_t i=0; i<layer.channels.size(); ++i) {
+            std::string name = layer.name + "." + layer.channels[i];
+            channels.insert(name, Imf::Channel(type));
+            frameBuffer.insert(name, Imf::Slice(Imf::FLOAT, base + i * compStride,
+                layer.view.m_pixelStride * compStride, layer.view.m_rowStride * compStride));
+        }
+    }
+
+    if (options.tileSize > 0) {
+        header.setTileDescription(Imf::TileDescription(
+            (unsigned int) options.tileSize, (unsigned int) options.tileSize, Imf::ONE_LEVEL));
+        Imf::TiledOutputFile file(path.c_str(), header);
+        file.setFrameBuffer(frameBuffer);
+        file.writeTiles(0, file.numXTiles() - 1, 0, file.numYTiles() - 1);
+    } else {
+        Imf::OutputFile file(path.c_str(), header);
+        file.setFrameBuffer(frameBuffer);
+        file.writePixels(m_size.y());
+    }
 }
 
-void Bitmap::savePNG(const std::string &filename) {
-    cout << "Writing a " << cols() << "x" << rows()
-         << " PNG file to \"" << filename << "\"" << endl;
+/**
+ * \brief Quantize a linear value to an 8-bit sRGB value
+ *
+ * Equivalent to <tt>(uint8_t) clamp(255 * Color3f(value).toSRGB(), 0, 255)</tt>,
+ * but instead of evaluating \c pow() per channel, the function searches a
+ * table holding the smallest linear value that maps to each output level.
+ */
+static uint8_t toSRGB8(float value) {
+    struct Thresholds {
+        float level[256];
 
-    std::string path = filename + ".png";
+        Thresholds() {
+            level[0] = -std::numeric_limits<float>::infinity();
+            for (int i=1; i<256; ++i) {
+                /* Bisect on the (monotonic) bit patterns of positive floats */
+                uint32_t lo = 0, hi = 0x3f800000u; /* 0.0 .. 1.0 */
+                while (lo < hi) {
+                    uint32_t mid = lo + (hi - lo) / 2;
+                    float x;
+                    memcpy(&x, &mid, sizeof(float));
+                    if ((int) clamp(255.f * Color3f(x).toSRGB()[0], 0.f, 255.f) >= i)
+                        hi = mid;
+                    else
+                        lo = mid + 1;
+                }
+                memcpy(&level[i], &lo, sizeof(float));
+            }
+        }
+    };
+    static const Thresholds table;
+
+    int index = 0;
+    for (int step = 128; step > 0; step >>= 1) {
+        if (value >= table.level[index + step])
+            index += step;
+    }
+    return (uint8_t) index;
+}
+
+/**
+ * \brief Compress a buffer into a zlib stream using all cores
+ *
+ * Used by stb_image_write for the image data of PNG files (with the same
+ * interface as its built-in compressor, including the \c malloc()'ed
+ * result). The data is deflated in independent chunks of about 256 KiB,
+ * each primed with the preceding 32 KiB as a dictionary so that the
+ * compression ratio hardly suffers. All but the last chunk end with a sync
+ * flush, hence the chunks concatenate into a single stream. Their Adler-32
+ * checksums are combined.
+ */
+static unsigned char *deflateParallel(unsigned char *data, int size, int *outSize, int quality) {
+    const size_t chunkSize = 1 << 18, dictSize = 32768;
+    int level = std::min(std::max(quality, 0), 9);
+    int chunkCount = std::max(1, (int) ((size + chunkSize - 1) / chunkSize));
+    std::vector<std::vector<uint8_t>> chunks(chunkCount);
+    std::vector<uLong> checksums(chunkCount);
+    std::atomic<bool> failed(false);
 
-    uint8_t *rgb8 = new uint8_t[3 * cols() * rows()];
-    uint8_t *dst = rgb8;
-    for (int i = 0; i < rows(); ++i) {
-        for (int j = 0; j < cols(); ++j) {
-            Color3f tonemapped = coeffRef(i, j).toSRGB();
-            dst[0] = (uint8_t) clamp(255.f * tonemapped[0], 0.f, 255.f);
-            dst[1] = (uint8_t) clamp(255.f * tonemapped[1], 0.f, 255.f);
-            dst[2] = (uint8_t) clamp(255.f * tonemapped[2], 0.f, 255.f);
-            dst += 3;
+    tbb::parallel_for(0, chunkCount, [&](int i) {
+        size_t start = (size_t) i * chunkSize,
+               length = std::min(chunkSize, (size_t) size - start);
+        Bytef *input = data + start;
+
+        z_stream strm;
+        memset(&strm, 0, sizeof(z_stream));
+        if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            failed = true;
+            return;
+        }
+        if (start > 0) {
+            size_t dict = std::min(dictSize, start);
+            deflateSetDictionary(&strm, input - dict, (uInt) dict);
         }
+
+        std::vector<uint8_t> &output = chunks[i];
+        output.resize(deflateBound(&strm, (uLong) length) + 64);
+        strm.next_in = input;
+        strm.avail_in = (uInt) length;
+        strm.next_out = output.data();
+        strm.avail_out = (uInt) output.size();
+
+        /* All but the last chunk end on a byte boundary without closing the stream */
+        int ret = deflate(&strm, i == chunkCount - 1 ? Z_FINISH : Z_SYNC_FLUSH);
+        if (strm.avail_in != 0 || ret == Z_STREAM_ERROR ||
+            (i == chunkCount - 1 && ret != Z_STREAM_END))
+            failed = true;
+        output.resize(output.size() - strm.avail_out);
+        deflateEnd(&strm);
+
+        checksums[i] = adler32(adler32(0L, Z_NULL, 0), input, (uInt) length);
+    });
+
+    if (failed)
+        return nullptr;
+
+    /* Assemble the zlib stream: header, chunks and checksum of the uncompressed data */
+    uLong adler = adler32(0L, Z_NULL, 0);
+    size_t total = 2 + 4;
+    for (int i=0; i<chunkCount; ++i) {
+        size_t start = (size_t) i * chunkSize;
+        adler = adler32_combine(adler, checksums[i],
+                                (z_off_t) std::min(chunkSize, (size_t) size - start));
+        total += chunks[i].size();
     }
 
-    int ret = stbi_write_png(path.c_str(), (int) cols(), (int) rows(), 3, rgb8, 3 * (int) cols());
-    if (ret == 0) {
-        cout << "Bitmap::savePNG(): Could not save PNG file \"" << path << "%s\"" << endl;
+    unsigned char *result = (unsigned char *) malloc(total), *ptr = result;
+    if (!result)
+        return nullptr;
+    *ptr++ = 0x78;
+    *ptr++ = 0x9c;
+    for (const std::vector<uint8_t> &chunk : chunks) {
+        memcpy(ptr, chunk.data(), chunk.size());
+        ptr += chunk.size();
     }
+    for (int shift = 24; shift >= 0; shift -= 8)
+        *ptr++ = (unsigned char) (adler >> shift);
+
+    *outSize = (int) total;
+    return result;
+}
+
+void BitmapView::savePNG(const std::string &filename) const {
+    cout << "Writing a " << m_size.x() << "x" << m_size.y()
+         << " PNG file to \"" << filename << "\"" << endl;
+
+    std::string path = filename + ".png";
+
+    /* Tonemap in parallel */
+    int width = m_size.x(), height = m_size.y();
+    std::unique_ptr<uint8_t[]> rgb8(new uint8_t[3 * (size_t) width * height]);
+    tbb::parallel_for(tbb::blocked_range<int>(0, height), [&](const tbb::blocked_range<int> &range) {
+        for (int i = range.begin(); i < range.end(); ++i) {
+            uint8_t *dst = rgb8.get() + 3 * (size_t) i * width;
+            for (int j = 0; j < width; ++j) {
+                Color3f value = coeff(i, j);
+                dst[0] = toSRGB8(value[0]);
+                dst[1] = toSRGB8(value[1]);
+                dst[2] = toSRGB8(value[2]);
+                dst += 3;
+            }
+        }
+    });
+
+    if (stbi_write_png(path.c_str(), width, height, 3, rgb8.get(), 3 * width) == 0)
+        cout << "Bitmap::savePNG(): Could not save PNG file \"" << path << "\"" << endl;
+}
 
-    delete[] rgb8;
+void Bitmap::setThreadCount(int threadCount) {
+    Imf::setGlobalThreadCount(threadCount);
 }
 
 NORI_NAMESPACE_END
@@ -26,9 +26,16 @@ NORI_NAMESPACE_BEGIN
 
 ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter) 
         : m_offset(0, 0), m_size(size) {
-    if (filter) {
+    if (filter && filter->isBox()) {
+        /* Each sample only touches the pixel containing it: no border or tables needed */
+        m_filterRadius = filter->getRadius();
+        m_box = true;
+    } else if (filter) {
         /* Tabulate the image reconstruction filter for performance reasons */
         m_filterRadius = filter->getRadius();
+        if (m_filterRadius > NORI_MAX_FILTER_RADIUS)
+            throw NoriException("ImageBlock: the filter radius (%f) exceeds the "
+                "supported maximum of %i pixels!", m_filterRadius, NORI_MAX_FILTER_RADIUS);
         m_borderSize = (int) std::ceil(m_filterRadius - 0.5f);
         m_filter = new float[NORI_FILTER_RESOLUTION + 1];
         for (int i=0; i<NORI_FILTER_RESOLUTION; ++i) {
@@ -37,11 +44,16 @@ ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
         }
         m_filter[NORI_FILTER_RESOLUTION] = 0.0f;
         m_lookupFactor = NORI_FILTER_RESOLUTION / m_filterRadius;
-        int weightSize = (int) std::ceil(2*m_filterRadius) + 1;
-        m_weightsX = new float[weightSize];
-        m_weightsY = new float[weightSize];
-        memset(m_weightsX, 0, sizeof(float) * weightSize);
-        memset(m_weightsY, 0, sizeof(float) * weightSize);
+
+        /* Select a specialized kernel for the common filter footprints */
+        m_footprint = (int) std::ceil(2*m_filterRadius) + 1;
+        switch (m_footprint) {
+            case 2: m_splat = &ImageBlock::splat<2>; break;
+            case 3: m_splat = &ImageBlock::splat<3>; break;
+            case 4: m_splat = &ImageBlock::splat<4>; break;
+            case 5: m_splat = &ImageBlock::splat<5>; break;
+            default: m_splat = nullptr; break;
+        }
     }
 
     /* Allocate space for pixels and border regions */
@@ -50,18 +62,41 @@ ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
 
 ImageBlock::~ImageBlock() {
     delete[] m_filter;
-    delete[] m_weightsX;
-    delete[] m_weightsY;
 }
 
 Bitmap *ImageBlock::toBitmap() const {
     Bitmap *result = new Bitmap(m_size);
-    for (int y=0; y<m_size.y(); ++y)
-        for (int x=0; x<m_size.x(); ++x)
-            result->coeffRef(y, x) = coeff(y + m_borderSize, x + m_borderSize).divideByFilterWeight();
+    tbb::parallel_for(tbb::blocked_range<int>(0, m_size.y()),
+        [&](const tbb::blocked_range<int> &range) {
+            for (int y=range.begin(); y<range.end(); ++y)
+                for (int x=0; x<m_size.x(); ++x)
+                    result->coeffRef(y, x) = coeff(y + m_borderSize, x + m_borderSize).divideByFilterWeight();
+        }
+    );
     return result;
 }
 
+void ImageBlock::normalize(const std::function<void (Color4f &)> &transform) {
+    tbb::parallel_for(tbb::blocked_range<int>(0, m_size.y()),
+        [&](const tbb::blocked_range<int> &range) {
+            for (int y=range.begin(); y<range.end(); ++y) {
+                for (int x=0; x<m_size.x(); ++x) {
+                    Color4f &pixel = coeffRef(y + m_borderSize, x + m_borderSize);
+                    float weight = pixel.w() != 0 ? 1.0f : 0.0f;
+                    pixel << pixel.divideByFilterWeight(), weight;
+                    if (transform)
+                        transform(pixel);
+                }
+            }
+        }
+    );
+}
+
+BitmapView ImageBlock::getView() const {
+    return BitmapView(coeff(m_borderSize, m_borderSize).data(), m_size,
+                      sizeof(Color4f) / sizeof(float), cols() * sizeof(Color4f) / sizeof(float));
+}
+
 void ImageBlock::fromBitmap(const Bitmap &bitmap) {
     if (bitmap.cols() != cols() || bitmap.rows() != rows())
         throw NoriException("Invalid bitmap dimensions!");
@@ -78,12 +113,65 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
         return;
     }
 
+    putUnchecked(_pos, value);
+}
+
+void ImageBlock::putUnchecked(const Point2f &_pos, const Color3f &value) {
+    if (m_box) {
+        /* Box filter: add the sample to the pixel containing it with unit weight */
+        int x = (int) std::floor(_pos.x()) - m_offset.x(),
+            y = (int) std::floor(_pos.y()) - m_offset.y();
+        if (x >= 0 && y >= 0 && x < cols() && y < rows())
+            coeffRef(y, x) += Color4f(value);
+        return;
+    }
+
     /* Convert to pixel coordinates within the image block */
     Point2f pos(
         _pos.x() - 0.5f - (m_offset.x() - m_borderSize),
         _pos.y() - 0.5f - (m_offset.y() - m_borderSize)
     );
 
+    /* Use the specialized kernel unless the footprint crosses the edge of the block */
+    if (m_splat) {
+        Point2i min((int) std::ceil(pos.x() - m_filterRadius),
+                    (int) std::ceil(pos.y() - m_filterRadius));
+        if (min.x() >= 0 && min.y() >= 0 &&
+            min.x() + m_footprint <= cols() && min.y() + m_footprint <= rows()) {
+            (this->*m_splat)(pos, min, Color4f(value));
+            return;
+        }
+    }
+
+    splatGeneric(pos, value);
+}
+
+inline float ImageBlock::filterWeight(float distance) const {
+    return m_filter[std::min((int) (std::abs(distance) * m_lookupFactor),
+                             NORI_FILTER_RESOLUTION)];
+}
+
+template <int Size> void ImageBlock::splat(const Point2f &pos, const Point2i &min,
+                                           const Color4f &value) {
+    /* Pixels past the end of the filter support receive a weight of zero */
+    Eigen::Array<float, 1, Size> weightsX;
+    Eigen::Array<float, Size, 1> weightsY;
+    for (int i=0; i<Size; ++i) {
+        weightsX[i] = filterWeight(min.x() + i - pos.x());
+        weightsY[i] = filterWeight(min.y() + i - pos.y());
+    }
+
+    /* Outer product of the color and the horizontal weights (one column per pixel) */
+    Eigen::Array<float, 4, Size> rowValue = (value.matrix() * weightsX.matrix()).array();
+
+    for (int i=0; i<Size; ++i) {
+        Eigen::Map<Eigen::Array<float, 4, Size>> target(
+            coeffRef(min.y() + i, min.x()).data());
+        target += rowValue * weightsY[i];
+    }
+}
+
+void ImageBlock::splatGeneric(const Point2f &pos, const Color3f &value) {
     /* Compute the rectangle of pixels that will need to be updated */
     BoundingBox2i bbox(
         Point2i((int)  std::ceil(pos.x() - m_filterRadius), (int)  std::ceil(pos.y() - m_filterRadius)),
@@ -92,14 +180,15 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
     bbox.clip(BoundingBox2i(Point2i(0, 0), Point2i((int) cols() - 1, (int) rows() - 1)));
 
     /* Lookup values from the pre-rasterized filter */
+    float weightsX[2*NORI_MAX_FILTER_RADIUS + 1], weightsY[2*NORI_MAX_FILTER_RADIUS + 1];
     for (int x=bbox.min.x(), idx = 0; x<=bbox.max.x(); ++x)
-        m_weightsX[idx++] = m_filter[(int) (std::abs(x-pos.x()) * m_lookupFactor)];
+        weightsX[idx++] = m_filter[(int) (std::abs(x-pos.x()) * m_lookupFactor)];
     for (int y=bbox.min.y(), idx = 0; y<=bbox.max.y(); ++y)
-        m_weightsY[idx++] = m_filter[(int) (std::abs(y-pos.y()) * m_lookupFactor)];
+        weightsY[idx++] = m_filter[(int) (std::abs(y-pos.y()) * m_lookupFactor)];
 
     for (int y=bbox.min.y(), yr=0; y<=bbox.max.y(); ++y, ++yr) 
         for (int x=bbox.min.x(), xr=0; x<=bbox.max.x(); ++x, ++xr) 
-            coeffRef(y, x) += Color4f(value) * m_weightsX[xr] * m_weightsY[yr];
+            coeffRef(y, x) += Color4f(value) * weightsX[xr] * weightsY[yr];
 }
     
 void ImageBlock::put(ImageBlock &b) {
@@ -107,10 +196,48 @@ void ImageBlock::put(ImageBlock &b) {
         Vector2i::Constant(m_borderSize - b.getBorderSize());
     Vector2i size   = b.getSize()   + Vector2i(2*b.getBorderSize());
 
-    tbb::mutex::scoped_lock lock(m_mutex);
+    if (!m_rowLocks) {
+        tbb::mutex::scoped_lock lock(m_mutex);
+
+        block(offset.y(), offset.x(), size.y(), size.x()) 
+            += b.topLeftCorner(size.y(), size.x());
+        return;
+    }
+
+    /* Width of the band along the edges that neighboring blocks also touch */
+    int overlap = 2 * b.getBorderSize();
 
-    block(offset.y(), offset.x(), size.y(), size.x()) 
-        += b.topLeftCorner(size.y(), size.x());
+    if (overlap == 0) {
+        /* Borderless blocks (box filter) never overlap: no locking required */
+        block(offset.y(), offset.x(), size.y(), size.x())
+            += b.topLeftCorner(size.y(), size.x());
+        return;
+    }
+
+    for (int y=0; y<size.y(); ++y) {
+        auto src = b.row(y).head(size.x());
+        auto dst = row(offset.y() + y).segment(offset.x(), size.x());
+
+        if (y < overlap || y >= size.y() - overlap || size.x() <= 2 * overlap) {
+            tbb::spin_mutex::scoped_lock lock(m_rowLocks[offset.y() + y]);
+            dst += src;
+        } else {
+            int inner = size.x() - 2 * overlap;
+            if (overlap > 0) {
+                tbb::spin_mutex::scoped_lock lock(m_rowLocks[offset.y() + y]);
+                dst.head(overlap) += src.head(overlap);
+                dst.tail(overlap) += src.tail(overlap);
+            }
+            dst.segment(overlap, inner) += src.segment(overlap, inner);
+        }
+    }
+}
+
+void ImageBlock::setStripedLocking(bool value) {
+    if (value)
+        m_rowLocks.reset(new tbb::spin_mutex[rows()]);
+    else
+        m_rowLocks.reset();
 }
 
 std::string ImageBlock::toString() const {
@@ -118,47 +245,134 @@ std::string ImageBlock::toString() const {
         m_offset.toString(), m_size.toString());
 }
 
-BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
-        : m_size(size), m_blockSize(blockSize) {
+SampleStatistics::SampleStatistics(const Vector2i &size)
+        : m_size(size), m_data(3, size.x() * size.y()) {
+    clear();
+}
+
+float SampleStatistics::getRelativeError(const Point2i &pixel) const {
+    auto entry = m_data.col(index(pixel));
+    double n = entry[0];
+    if (n < 2)
+        return std::numeric_limits<float>::infinity();
+
+    double mean = entry[1] / n,
+           variance = std::max(0.0, (entry[2] - entry[1] * mean) / (n - 1));
+
+    /* Don't demand an impossibly small absolute error in dark regions */
+    return (float) (std::sqrt(variance / n) / std::max(mean, 1e-3));
+}
+
+BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize, EOrder order,
+                               const BoundingBox2i &crop)
+        : m_size(size), m_crop(Point2i(0, 0), Point2i(size.x(), size.y())),
+          m_blockSize(blockSize), m_next(0) {
     m_numBlocks = Vector2i(
         (int) std::ceil(size.x() / (float) blockSize),
         (int) std::ceil(size.y() / (float) blockSize));
-    m_blocksLeft = m_numBlocks.x() * m_numBlocks.y();
-    m_direction = ERight;
-    m_block = Point2i(m_numBlocks / 2);
-    m_stepsLeft = 1;
-    m_numSteps = 1;
+    m_blocks.reserve(m_numBlocks.x() * m_numBlocks.y());
+
+    switch (order) {
+        case ESpiral:   generateSpiral(); break;
+        case EHilbert:  generateHilbert(); break;
+        case EScanline: generateScanline(); break;
+    }
+
+    /* Drop the blocks outside of the crop window */
+    if (crop.isValid() && crop.getVolume() > 0) {
+        m_crop.clip(crop);
+        m_blocks.erase(std::remove_if(m_blocks.begin(), m_blocks.end(),
+            [&](const Point2i &block) {
+                Point2i pos = block * m_blockSize;
+                BoundingBox2i bounds(pos, pos + Vector2i::Constant(m_blockSize));
+                return !m_crop.isValid() || !bounds.overlaps(m_crop, true);
+            }), m_blocks.end());
+    }
 }
 
-bool BlockGenerator::next(ImageBlock &block) {
-    tbb::mutex::scoped_lock lock(m_mutex);
+BlockGenerator::EOrder BlockGenerator::parseOrder(const std::string &name) {
+    std::string value = toLower(name);
+    if (value == "spiral")
+        return ESpiral;
+    else if (value == "hilbert")
+        return EHilbert;
+    else if (value == "scanline")
+        return EScanline;
+    throw NoriException("Unknown block order \"%s\" (expected "
+        "\"spiral\", \"hilbert\" or \"scanline\")", name);
+}
 
-    if (m_blocksLeft == 0)
-        return false;
+void BlockGenerator::generateSpiral() {
+    int blocksLeft = m_numBlocks.x() * m_numBlocks.y();
+    int direction = ERight, numSteps = 1, stepsLeft = 1;
+    Point2i block(m_numBlocks / 2);
 
-    Point2i pos = m_block * m_blockSize;
-    block.setOffset(pos);
-    block.setSize((m_size - pos).cwiseMin(Vector2i::Constant(m_blockSize)));
+    while (blocksLeft > 0) {
+        m_blocks.push_back(block);
+        if (--blocksLeft == 0)
+            break;
 
-    if (--m_blocksLeft == 0)
-        return true;
+        do {
+            switch (direction) {
+                case ERight: ++block.x(); break;
+                case EDown:  ++block.y(); break;
+                case ELeft:  --block.x(); break;
+                case EUp:    --block.y(); break;
+            }
 
-    do {
-        switch (m_direction) {
-            case ERight: ++m_block.x(); break;
-            case EDown:  ++m_block.y(); break;
-            case ELeft:  --m_block.x(); break;
-            case EUp:    --m_block.y(); break;
-        }
+            if (--stepsLeft == 0) {
+                direction = (direction + 1) % 4;
+                if (direction == ELeft || direction == ERight) 
+                    ++numSteps;
+                stepsLeft = numSteps;
+            }
+        } while ((block.array() < 0).any() ||
+                 (block.array() >= m_numBlocks.array()).any());
+    }
+}
 
-        if (--m_stepsLeft == 0) {
-            m_direction = (m_direction + 1) % 4;
-            if (m_direction == ELeft || m_direction == ERight) 
-                ++m_numSteps;
-            m_stepsLeft = m_numSteps;
+void BlockGenerator::generateHilbert() {
+    /* Walk a Hilbert curve over the enclosing power-of-two grid
+       and skip the cells that lie outside of the image */
+    int n = 1;
+    while (n < m_numBlocks.x() || n < m_numBlocks.y())
+        n *= 2;
+
+    for (int d = 0; d < n * n; ++d) {
+        int x = 0, y = 0;
+        for (int s = 1, t = d; s < n; s *= 2, t /= 4) {
+            int rx = 1 & (t / 2), ry = 1 & (t ^ rx);
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+            x += s * rx;
+            y += s * ry;
         }
-    } while ((m_block.array() < 0).any() ||
-             (m_block.array() >= m_numBlocks.array()).any());
+        if (x < m_numBlocks.x() && y < m_numBlocks.y())
+            m_blocks.push_back(Point2i(x, y));
+    }
+}
+
+void BlockGenerator::generateScanline() {
+    for (int y = 0; y < m_numBlocks.y(); ++y)
+        for (int x = 0; x < m_numBlocks.x(); ++x)
+            m_blocks.push_back(Point2i(x, y));
+}
+
+bool BlockGenerator::next(ImageBlock &block) {
+    int index = m_next.fetch_add(1, std::memory_order_relaxed);
+    if (index >= (int) m_blocks.size())
+        return false;
+
+    Point2i pos = m_blocks[index] * m_blockSize;
+    Point2i end = (pos + Vector2i::Constant(m_blockSize)).cwiseMin(m_crop.max);
+    pos = pos.cwiseMax(m_crop.min);
+    block.setOffset(pos);
+    block.setSize(end - pos);
 
     return true;
 }
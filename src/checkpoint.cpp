@@ -0,0 +1,120 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/checkpoint.h>
+#include <cstdio>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+/// Identifies Nori checkpoint files
+static const char checkpointMagic[4] = { 'N', 'C', 'K', 'P' };
+
+/// Bumped whenever the file layout changes
+static const uint32_t checkpointVersion = 2;
+
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t rows, cols, borderSize;
+    int32_t cropMin[2], cropMax[2];
+    uint32_t hasStats;
+    RenderProgress progress;
+};
+
+void saveCheckpoint(const std::string &filename, const RenderProgress &progress,
+                    const BoundingBox2i &crop, const ImageBlock &result,
+                    const SampleStatistics *stats) {
+    CheckpointHeader header;
+    std::copy(checkpointMagic, checkpointMagic + 4, header.magic);
+    header.version = checkpointVersion;
+    header.rows = (int32_t) result.rows();
+    header.cols = (int32_t) result.cols();
+    header.borderSize = result.getBorderSize();
+    for (int i=0; i<2; ++i) {
+        header.cropMin[i] = crop.min[i];
+        header.cropMax[i] = crop.max[i];
+    }
+    header.hasStats = stats ? 1 : 0;
+    header.progress = progress;
+
+    std::string tempName = filename + ".tmp";
+    std::ofstream os(tempName, std::ios::binary | std::ios::trunc);
+    if (!os)
+        throw NoriException("Unable to open checkpoint file \"%s\" for writing!", tempName);
+
+    os.write((const char *) &header, sizeof(CheckpointHeader));
+    os.write((const char *) result.data(),
+             sizeof(float) * 4 * result.rows() * result.cols());
+    if (stats) {
+        Vector2i size = stats->getSize();
+        os.write((const char *) stats->data(),
+                 sizeof(double) * 3 * size.x() * size.y());
+    }
+    os.close();
+    if (!os)
+        throw NoriException("Unable to write checkpoint file \"%s\"!", tempName);
+
+    std::remove(filename.c_str());
+    if (std::rename(tempName.c_str(), filename.c_str()) != 0)
+        throw NoriException("Unable to rename \"%s\" to \"%s\"!", tempName, filename);
+}
+
+bool loadCheckpoint(const std::string &filename, RenderProgress &progress,
+                    const BoundingBox2i &crop, ImageBlock &result,
+                    SampleStatistics *stats) {
+    std::ifstream is(filename, std::ios::binary);
+    if (!is)
+        return false;
+
+    CheckpointHeader header;
+    is.read((char *) &header, sizeof(CheckpointHeader));
+    if (!is || !std::equal(checkpointMagic, checkpointMagic + 4, header.magic))
+        throw NoriException("\"%s\" is not a checkpoint file!", filename);
+    if (header.version != checkpointVersion)
+        throw NoriException("Checkpoint \"%s\" has an unsupported version (%i)!",
+                            filename, header.version);
+    if (header.rows != result.rows() || header.cols != result.cols() ||
+        header.borderSize != result.getBorderSize() ||
+        header.hasStats != (stats ? 1u : 0u) ||
+        header.progress.sampleCount != progress.sampleCount ||
+        header.progress.passSampleCount != progress.passSampleCount)
+        throw NoriException("Checkpoint \"%s\" was written for a different image size, "
+                            "reconstruction filter or sampling configuration!", filename);
+    if (header.cropMin[0] != crop.min.x() || header.cropMin[1] != crop.min.y() ||
+        header.cropMax[0] != crop.max.x() || header.cropMax[1] != crop.max.y())
+        throw NoriException("Checkpoint \"%s\" was written for the crop window %i,%i,%i,%i!",
+                            filename, header.cropMin[0], header.cropMin[1],
+                            header.cropMax[0] - header.cropMin[0],
+                            header.cropMax[1] - header.cropMin[1]);
+
+    is.read((char *) result.data(),
+            sizeof(float) * 4 * result.rows() * result.cols());
+    if (stats) {
+        Vector2i size = stats->getSize();
+        is.read((char *) stats->data(),
+                sizeof(double) * 3 * size.x() * size.y());
+    }
+    if (!is)
+        throw NoriException("Checkpoint \"%s\" is truncated!", filename);
+
+    progress = header.progress;
+    return true;
+}
+
+NORI_NAMESPACE_END
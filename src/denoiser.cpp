@@ -0,0 +1,116 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/denoiser.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+std::string DenoiserOptions::toString() const {
+    return tfm::format("radius=%i, sigmaSpatial=%.2f, sigmaColor=%.2f, sigmaAlbedo=%.2f, "
+                       "sigmaNormal=%.2f, sigmaDepth=%.2f", radius, sigmaSpatial, sigmaColor,
+                       sigmaAlbedo, sigmaNormal, sigmaDepth);
+}
+
+Bitmap *denoise(const BitmapView &beauty, const AOVBuffer &aovs, uint32_t sampleCount,
+                const SampleStatistics *stats, const DenoiserOptions &options) {
+    if ((aovs.getMask() & NORI_DENOISER_AOVS) != NORI_DENOISER_AOVS)
+        throw NoriException("denoise(): the albedo, normal and variance AOVs are required!");
+
+    BitmapView albedo = aovs.getView(EAlbedo),
+               normal = aovs.getView(ENormal),
+               variance = aovs.getView(EVariance);
+    bool hasDepth = aovs.has(EDepth);
+    BitmapView depth = hasDepth ? aovs.getView(EDepth) : albedo;
+
+    Vector2i size = beauty.getSize();
+    if (stats && stats->getSize() != size)
+        throw NoriException("denoise(): the sample statistics have a different size!");
+    int radius = std::max(options.radius, 0);
+
+    /* Precompute the reciprocals of 2 * sigma^2 (and of sigma for the depth) */
+    float invSpatial = 1.0f / (2.0f * options.sigmaSpatial * options.sigmaSpatial),
+          invColor   = 1.0f / (2.0f * options.sigmaColor * options.sigmaColor),
+          invAlbedo  = 1.0f / (2.0f * options.sigmaAlbedo * options.sigmaAlbedo),
+          invNormal  = 1.0f / (2.0f * options.sigmaNormal * options.sigmaNormal),
+          invDepth   = 1.0f / options.sigmaDepth;
+
+    /* Squared standard error of every pixel: its sample variance divided
+       by the number of samples that the pixel actually received */
+    Eigen::ArrayXXf error(size.y(), size.x());
+    tbb::parallel_for(tbb::blocked_range<int>(0, size.y()),
+        [&](const tbb::blocked_range<int> &range) {
+            for (int y=range.begin(); y<range.end(); ++y) {
+                for (int x=0; x<size.x(); ++x) {
+                    uint32_t count = stats ? stats->getSampleCount(Point2i(x, y)) : sampleCount;
+                    error(y, x) = variance.coeff(y, x).r() / (float) std::max(count, 1u);
+                }
+            }
+        }
+    );
+
+    Bitmap *result = new Bitmap(size);
+    tbb::parallel_for(tbb::blocked_range<int>(0, size.y()),
+        [&](const tbb::blocked_range<int> &range) {
+            for (int y=range.begin(); y<range.end(); ++y) {
+                for (int x=0; x<size.x(); ++x) {
+                    Color3f c = beauty.coeff(y, x), a = albedo.coeff(y, x),
+                            n = normal.coeff(y, x);
+                    float v = error(y, x),
+                          d = hasDepth ? depth.coeff(y, x).r() : 0.0f;
+
+                    Color3f sum(0.0f);
+                    float weightSum = 0.0f;
+
+                    for (int qy=std::max(y - radius, 0); qy<=std::min(y + radius, size.y() - 1); ++qy) {
+                        for (int qx=std::max(x - radius, 0); qx<=std::min(x + radius, size.x() - 1); ++qx) {
+                            Color3f qc = beauty.coeff(qy, qx);
+                            float qv = error(qy, qx);
+
+                            /* Color distance relative to the noise of both estimates */
+                            float colorDist = (c - qc).matrix().squaredNorm() / 3.0f;
+                            float exponent =
+                                ((qx - x) * (qx - x) + (qy - y) * (qy - y)) * invSpatial +
+                                colorDist * invColor / (v + qv + 1e-10f) +
+                                (a - albedo.coeff(qy, qx)).matrix().squaredNorm() * invAlbedo +
+                                (n - normal.coeff(qy, qx)).matrix().squaredNorm() * invNormal;
+
+                            if (hasDepth) {
+                                float relDepth = std::abs(d - depth.coeff(qy, qx).r())
+                                    / std::max(d, Epsilon) * invDepth;
+                                exponent += 0.5f * relDepth * relDepth;
+                            }
+
+                            float weight = std::exp(-exponent);
+                            sum += qc * weight;
+                            weightSum += weight;
+                        }
+                    }
+
+                    /* The center pixel always contributes with unit weight */
+                    result->coeffRef(y, x) = sum / weightSum;
+                }
+            }
+        }
+    );
+
+    return result;
+}
+
+NORI_NAMESPACE_END
@@ -86,6 +86,10 @@ public:
         return true;
     }
 
+    Color3f getAlbedo() const {
+        return m_albedo;
+    }
+
     /// Return a human-readable summary
     std::string toString() const {
         return tfm::format(
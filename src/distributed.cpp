@@ -0,0 +1,384 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/distributed.h>
+#include <nori/render.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <cstring>
+
+#if defined(PLATFORM_WINDOWS)
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#  define closeSocket closesocket
+#else
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <netdb.h>
+#  include <unistd.h>
+#  define closeSocket ::close
+#  define INVALID_SOCKET (-1)
+#endif
+
+/* Writing to a closed connection should fail instead of raising SIGPIPE */
+#if defined(MSG_NOSIGNAL)
+#  define NORI_SEND_FLAGS MSG_NOSIGNAL
+#else
+#  define NORI_SEND_FLAGS 0
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+/// Identifies the Nori render protocol
+#define NORI_PROTOCOL_MAGIC 0x49524F4E
+
+/// Bumped whenever the messages change
+#define NORI_PROTOCOL_VERSION 1
+
+/// Message types sent from the coordinator to a worker
+enum ETaskType {
+    ERenderBlock = 0,
+    EQuit
+};
+
+/// First message on every connection, used to check that both sides agree
+struct Handshake {
+    uint32_t magic, version;
+    int32_t width, height, borderSize;
+    uint32_t sampleCount;
+
+    Handshake() { }
+
+    Handshake(const Scene *scene, int borderSize) : magic(NORI_PROTOCOL_MAGIC),
+        version(NORI_PROTOCOL_VERSION), width(scene->getCamera()->getOutputSize().x()),
+        height(scene->getCamera()->getOutputSize().y()), borderSize(borderSize),
+        sampleCount((uint32_t) scene->getSampler()->getSampleCount()) { }
+
+    bool operator==(const Handshake &h) const {
+        return magic == h.magic && version == h.version && width == h.width &&
+            height == h.height && borderSize == h.borderSize && sampleCount == h.sampleCount;
+    }
+};
+
+static void initSockets() {
+#if defined(PLATFORM_WINDOWS)
+    static bool initialized = [] {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    if (!initialized)
+        throw NoriException("Unable to initialize Winsock!");
+#endif
+}
+
+/// Send exactly \c size bytes, return \c false if the connection broke down
+static bool sendAll(intptr_t socket, const void *data, size_t size) {
+    const char *ptr = (const char *) data;
+    while (size > 0) {
+        int chunk = (int) std::min(size, (size_t) (1 << 20));
+        auto sent = ::send(socket, ptr, chunk, NORI_SEND_FLAGS);
+        if (sent <= 0)
+            return false;
+        ptr += sent;
+        size -= (size_t) sent;
+    }
+    return true;
+}
+
+/// Receive exactly \c size bytes, return \c false if the connection broke down
+static bool recvAll(intptr_t socket, void *data, size_t size) {
+    char *ptr = (char *) data;
+    while (size > 0) {
+        int chunk = (int) std::min(size, (size_t) (1 << 20));
+        auto received = ::recv(socket, ptr, chunk, 0);
+        if (received <= 0)
+            return false;
+        ptr += received;
+        size -= (size_t) received;
+    }
+    return true;
+}
+
+/// Blocks are small and latency-bound, don't let Nagle's algorithm hold them back
+static void setNoDelay(intptr_t socket) {
+    int flag = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char *) &flag, sizeof(int));
+#if defined(SO_NOSIGPIPE)
+    setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, (const char *) &flag, sizeof(int));
+#endif
+}
+
+/// Border size of the image blocks that are exchanged for the given scene
+static int getBorderSize(const Scene *scene) {
+    ImageBlock block(Vector2i(1), scene->getCamera()->getReconstructionFilter());
+    return block.getBorderSize();
+}
+
+RenderCoordinator::RenderCoordinator(int port, const Scene *scene)
+    : m_scene(scene), m_workerCount(0) {
+    initSockets();
+
+    m_listener = (intptr_t) ::socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listener == (intptr_t) INVALID_SOCKET)
+        throw NoriException("Unable to create a socket!");
+
+    int flag = 1;
+    setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, (const char *) &flag, sizeof(int));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t) port);
+
+    if (::bind(m_listener, (const sockaddr *) &addr, sizeof(sockaddr_in)) != 0 ||
+        ::listen(m_listener, 64) != 0) {
+        closeSocket(m_listener);
+        throw NoriException("Unable to listen on port %i!", port);
+    }
+
+    cout << "Waiting for workers on port " << port << " .." << endl;
+    m_acceptThread = std::thread([this] { acceptWorkers(); });
+}
+
+RenderCoordinator::~RenderCoordinator() {
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_shutdown = true;
+    }
+    m_cond.notify_all();
+
+    /* Unblock the accept() call */
+#if defined(PLATFORM_WINDOWS)
+    closeSocket(m_listener);
+#else
+    ::shutdown(m_listener, SHUT_RDWR);
+    closeSocket(m_listener);
+#endif
+    m_acceptThread.join();
+
+    for (auto &thread : m_workerThreads)
+        thread.join();
+}
+
+void RenderCoordinator::acceptWorkers() {
+    while (true) {
+        intptr_t socket = (intptr_t) ::accept(m_listener, nullptr, nullptr);
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (m_shutdown) {
+            if (socket != (intptr_t) INVALID_SOCKET)
+                closeSocket(socket);
+            break;
+        }
+        if (socket == (intptr_t) INVALID_SOCKET)
+            continue;
+        m_workerThreads.emplace_back([this, socket] { serveWorker(socket); });
+    }
+}
+
+void RenderCoordinator::serveWorker(intptr_t socket) {
+    setNoDelay(socket);
+
+    const ReconstructionFilter *filter = m_scene->getCamera()->getReconstructionFilter();
+    Handshake expected(m_scene, getBorderSize(m_scene)), handshake;
+
+    if (!recvAll(socket, &handshake, sizeof(Handshake)) || !(handshake == expected)) {
+        cerr << "Rejecting a worker that rendered a different scene configuration" << endl;
+        closeSocket(socket);
+        return;
+    }
+    ++m_workerCount;
+
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this] { return m_shutdown || !m_tasks.empty(); });
+            if (m_shutdown) {
+                Task quit;
+                memset(&quit, 0, sizeof(Task));
+                quit.type = EQuit;
+                sendAll(socket, &quit, sizeof(Task));
+                break;
+            }
+            task = m_tasks.front();
+            m_tasks.pop_front();
+        }
+
+        std::unique_ptr<ImageBlock> block(new ImageBlock(Vector2i(NORI_BLOCK_SIZE), filter));
+        size_t blockBytes = sizeof(float) * 4 * block->rows() * block->cols();
+
+        if (!sendAll(socket, &task, sizeof(Task)) ||
+            !recvAll(socket, block->data(), blockBytes)) {
+            /* The worker went away, let somebody else render the block */
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_tasks.push_front(task);
+            m_cond.notify_all();
+            cerr << "Lost connection to a worker" << endl;
+            break;
+        }
+
+        block->setOffset(Point2i(task.offsetX, task.offsetY));
+        block->setSize(Vector2i(task.sizeX, task.sizeY));
+
+        /* Merge all blocks that are now available in generator order, so
+           that the floating point sums don't depend on the arrival order */
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_received[task.index] = std::move(block);
+        while (m_nextMerge < m_received.size() && m_received[m_nextMerge]) {
+            m_result->put(*m_received[m_nextMerge]);
+            m_received[m_nextMerge++].reset();
+        }
+        --m_pending;
+        m_cond.notify_all();
+    }
+
+    --m_workerCount;
+    closeSocket(socket);
+}
+
+bool RenderCoordinator::renderPass(BlockGenerator &generator, uint32_t pass,
+        uint32_t sampleCount, ImageBlock &result, const std::atomic<bool> &abort,
+        const std::atomic<bool> &stop) {
+    ImageBlock block(Vector2i(NORI_BLOCK_SIZE), nullptr);
+
+    /* Accumulate the pass separately, so that an abandoned pass can be discarded */
+    if (!m_passResult || m_passResult->getSize() != result.getSize())
+        m_passResult.reset(new ImageBlock(result.getSize(),
+                                          m_scene->getCamera()->getReconstructionFilter()));
+    m_passResult->clear();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_result = m_passResult.get();
+    m_received.clear();
+    m_received.resize(generator.getBlockCount());
+    m_nextMerge = 0;
+    for (uint32_t index = 0; generator.next(block); ++index) {
+        Task task;
+        task.type = ERenderBlock;
+        task.index = index;
+        task.pass = pass;
+        task.sampleCount = sampleCount;
+        task.offsetX = block.getOffset().x();
+        task.offsetY = block.getOffset().y();
+        task.sizeX = block.getSize().x();
+        task.sizeY = block.getSize().y();
+        m_tasks.push_back(task);
+        ++m_pending;
+    }
+    m_cond.notify_all();
+
+    bool complete = true;
+    while (m_pending > 0) {
+        m_cond.wait_for(lock, std::chrono::milliseconds(100));
+        if ((abort || (stop && m_workerCount == 0)) && !m_tasks.empty()) {
+            m_pending -= m_tasks.size();
+            m_tasks.clear();
+            complete = false;
+        }
+    }
+    m_result = nullptr;
+    m_received.clear();
+    lock.unlock();
+
+    if (complete)
+        result.put(*m_passResult);
+    return complete;
+}
+
+void runWorker(Scene *scene, const std::string &address, int threadCount) {
+    initSockets();
+    scene->getIntegrator()->preprocess(scene);
+
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+        throw NoriException("Expected the coordinator address as host:port, got \"%s\"!", address);
+    std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+
+    addrinfo hints, *info = nullptr;
+    memset(&hints, 0, sizeof(addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &info) != 0 || !info)
+        throw NoriException("Unable to resolve \"%s\"!", address);
+
+    std::vector<intptr_t> sockets;
+    for (int i=0; i<threadCount; ++i) {
+        intptr_t socket = (intptr_t) ::socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (socket == (intptr_t) INVALID_SOCKET ||
+            ::connect(socket, info->ai_addr, (int) info->ai_addrlen) != 0) {
+            if (socket != (intptr_t) INVALID_SOCKET)
+                closeSocket(socket);
+            break;
+        }
+        setNoDelay(socket);
+        sockets.push_back(socket);
+    }
+    freeaddrinfo(info);
+
+    if (sockets.empty())
+        throw NoriException("Unable to connect to the coordinator at \"%s\"!", address);
+
+    cout << "Connected to \"" << address << "\" with " << sockets.size()
+         << " threads .." << endl;
+
+    Handshake handshake(scene, getBorderSize(scene));
+    std::atomic<size_t> blocksRendered(0);
+    std::vector<std::thread> threads;
+
+    for (intptr_t socket : sockets) {
+        threads.emplace_back([&, socket] {
+            ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
+                scene->getCamera()->getReconstructionFilter());
+            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+            size_t blockBytes = sizeof(float) * 4 * block.rows() * block.cols();
+
+            if (!sendAll(socket, &handshake, sizeof(Handshake))) {
+                closeSocket(socket);
+                return;
+            }
+
+            while (true) {
+                RenderCoordinator::Task task;
+                if (!recvAll(socket, &task, sizeof(task)) || task.type != ERenderBlock)
+                    break;
+
+                block.setOffset(Point2i(task.offsetX, task.offsetY));
+                block.setSize(Vector2i(task.sizeX, task.sizeY));
+                sampler->prepare(block, task.pass);
+                renderBlock(scene, sampler.get(), block, task.sampleCount);
+
+                if (!sendAll(socket, block.data(), blockBytes))
+                    break;
+                ++blocksRendered;
+            }
+            closeSocket(socket);
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    cout << "Coordinator finished, rendered " << blocksRendered << " blocks." << endl;
+}
+
+NORI_NAMESPACE_END
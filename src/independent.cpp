@@ -34,6 +34,13 @@ class Independent : public Sampler {
 public:
     Independent(const PropertyList &propList) {
         m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+
+        /* Adaptive sampling: stop sampling pixels whose relative error is below
+           the threshold once they have received 'minSampleCount' samples */
+        m_minSampleCount = (size_t) propList.getInteger("minSampleCount", (int) m_sampleCount);
+        m_errorThreshold = propList.getFloat("errorThreshold", 0.f);
+        if (m_minSampleCount == 0 || m_minSampleCount > m_sampleCount)
+            throw NoriException("Independent: 'minSampleCount' must be between 1 and 'sampleCount'!");
     }
 
     virtual ~Independent() { }
@@ -41,14 +48,17 @@ public:
     std::unique_ptr<Sampler> clone() const {
         std::unique_ptr<Independent> cloned(new Independent());
         cloned->m_sampleCount = m_sampleCount;
+        cloned->m_minSampleCount = m_minSampleCount;
+        cloned->m_errorThreshold = m_errorThreshold;
         cloned->m_random = m_random;
         return std::move(cloned);
     }
 
-    void prepare(const ImageBlock &block) {
+    void prepare(const ImageBlock &block, uint32_t pass) {
+        /* Every pass uses a separate stream of the generator */
         m_random.seed(
             block.getOffset().x(),
-            block.getOffset().y()
+            block.getOffset().y() + ((uint64_t) pass << 32)
         );
     }
 
@@ -67,6 +77,9 @@ public:
     }
 
     std::string toString() const {
+        if (isAdaptive())
+            return tfm::format("Independent[sampleCount=%i, minSampleCount=%i, errorThreshold=%f]",
+                               m_sampleCount, m_minSampleCount, m_errorThreshold);
         return tfm::format("Independent[sampleCount=%i]", m_sampleCount);
     }
 protected:
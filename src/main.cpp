@@ -25,60 +25,312 @@
 #include <nori/sampler.h>
 #include <nori/integrator.h>
 #include <nori/gui.h>
+#include <nori/checkpoint.h>
+#include <nori/render.h>
+#include <nori/distributed.h>
+#include <nori/wavefront.h>
+#include <nori/server.h>
+#include <nori/stream.h>
+#include <nori/aov.h>
+#include <nori/denoiser.h>
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
 #include <tbb/global_control.h>
 #include <filesystem/resolver.h>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <mutex>
 #include <thread>
 
 using namespace nori;
 
 static int threadCount = -1;
 static bool gui = true;
+static bool watch = false;
+static BlockGenerator::EOrder blockOrder = BlockGenerator::ESpiral;
+static int progressive = 0;
+static float timeLimit = 0.f;
+static bool checkpoint = false;
+static bool resume = false;
+static bool wavefront = false;
+static bool streamOutput = false;
+static uint32_t aovMask = 0;
+static bool denoiseOutput = false;
+static bool server = false;
+static BoundingBox2i cropWindow;
+static bool splice = false;
+static EXROptions exrOptions;
+static int listenPort = 0;
+static std::string coordinatorAddress;
+static std::atomic<bool> abortRender(false);
+static std::atomic<bool> stopRender(false);
 
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) {
-    const Camera *camera = scene->getCamera();
-    const Integrator *integrator = scene->getIntegrator();
+/// Minimum time between two EXR snapshots of a progressive render (in ms)
+#define NORI_SNAPSHOT_INTERVAL 10000
 
-    Point2i offset = block.getOffset();
-    Vector2i size  = block.getSize();
+/// Number of passes that a single-pass render is split into for checkpointing
+#define NORI_CHECKPOINT_PASSES 16
 
-    /* Clear the block contents */
-    block.clear();
+/// Strip the extension from the scene filename to obtain the output name
+static std::string getOutputName(const std::string &filename) {
+    std::string outputName = filename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
+    return outputName;
+}
 
-    /* For each pixel and pixel sample sample */
-    for (int y=0; y<size.y(); ++y) {
-        for (int x=0; x<size.x(); ++x) {
-            for (uint32_t i=0; i<sampler->getSampleCount(); ++i) {
-                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
-                Point2f apertureSample = sampler->next2D();
+/**
+ * \brief Load a scene (or other XML object) from disk
+ *
+ * The parent directory of the file is added to the file resolver while it
+ * loads. That way, the XML file can reference resources (OBJ files,
+ * textures) using relative paths, and scenes in different directories
+ * don't pick up each other's files when they use the same relative names.
+ */
+static NoriObject *loadScene(const std::string &filename) {
+    filesystem::resolver *resolver = getFileResolver();
+    resolver->prepend(filesystem::path(filename).parent_path());
+    NoriObject *root;
+    try {
+        root = loadFromXML(filename);
+    } catch (...) {
+        resolver->erase(resolver->begin());
+        throw;
+    }
+    resolver->erase(resolver->begin());
+    return root;
+}
 
-                /* Sample a ray from the camera */
-                Ray3f ray;
-                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+/**
+ * \brief Does the filename contain exactly one integer conversion (and
+ * otherwise only escaped percent signs), so that it can be used as a
+ * frame template with \c tfm::format()?
+ */
+static bool isFrameTemplate(const std::string &name) {
+    int conversions = 0;
+    for (size_t i = 0; i < name.size(); ++i) {
+        if (name[i] != '%')
+            continue;
+        if (++i < name.size() && name[i] == '%')
+            continue;
+        /* Flags, width and precision */
+        while (i < name.size() && std::strchr("-+ #0123456789.", name[i]))
+            ++i;
+        if (i == name.size() || !std::strchr("diuxXo", name[i]))
+            return false;
+        ++conversions;
+    }
+    return conversions == 1;
+}
 
-                /* Compute the incident radiance */
-                value *= integrator->Li(scene, sampler, ray);
+/**
+ * \brief Render a scene in a single pass while writing the image to disk
+ *
+ * Instead of keeping the whole frame in memory, finished blocks are handed
+ * to a \ref TileStream, which only holds the rows of tiles that are still
+ * being rendered. The blocks are therefore generated in scanline order. No
+ * PNG file is written, as that would again require the entire image.
+ */
+static void renderStreaming(Scene *scene, const std::string &filename) {
+    const Camera *camera = scene->getCamera();
+    const Sampler *sceneSampler = scene->getSampler();
+    Vector2i outputSize = camera->getOutputSize();
+    if (sceneSampler->isAdaptive())
+        throw NoriException("Adaptive sampling cannot be combined with streaming output!");
+    if (camera->getCropWindow().getVolume() > 0 || scene->getTimeLimit() > 0)
+        throw NoriException("Streaming output does not support crop windows or time limits!");
+    scene->getIntegrator()->preprocess(scene);
 
-                /* Store in the image block */
-                block.put(pixelSample, value);
-            }
-        }
+    uint32_t sampleCount = (uint32_t) sceneSampler->getSampleCount();
+    const ReconstructionFilter *filter = camera->getReconstructionFilter();
+    std::map<std::string, std::string> metadata = {
+        { "samplesPerPixel", std::to_string(sampleCount) },
+        { "passes", "1" }
+    };
+    TileStream stream(getOutputName(filename), outputSize, filter, exrOptions, metadata);
+    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE, BlockGenerator::EScanline);
+
+    /* Pressing Ctrl-C stops rendering, the remaining tiles are left black */
+    stopRender = false;
+    std::signal(SIGINT, [](int) {
+        stopRender = true;
+        std::signal(SIGINT, SIG_DFL);
+    });
+
+    cout << "Rendering .. ";
+    cout.flush();
+    Timer timer;
+
+    {
+        tbb::global_control gc(tbb::global_control::max_allowed_parallelism, threadCount);
+        tbb::parallel_for(tbb::blocked_range<int>(0, blockGenerator.getBlockCount()),
+            [&](const tbb::blocked_range<int> &range) {
+                ImageBlock block(Vector2i(NORI_BLOCK_SIZE), filter);
+                std::unique_ptr<Sampler> sampler(sceneSampler->clone());
+
+                for (int i=range.begin(); i<range.end(); ++i) {
+                    if (abortRender || stopRender)
+                        break;
+                    blockGenerator.next(block);
+                    sampler->prepare(block, 0);
+                    renderBlock(scene, sampler.get(), block, sampleCount);
+                    stream.put(block);
+                }
+            });
     }
+
+    std::signal(SIGINT, SIG_DFL);
+    stream.finish();
+
+    cout << (abortRender || stopRender ? "stopped. (took " : "done. (took ")
+         << timer.elapsedString() << ", at most " << stream.getPeakRowCount()
+         << " rows of tiles were resident)" << endl;
 }
 
 static void render(Scene *scene, const std::string &filename) {
+    if (streamOutput) {
+        renderStreaming(scene, filename);
+        return;
+    }
+
     const Camera *camera = scene->getCamera();
     Vector2i outputSize = camera->getOutputSize();
     scene->getIntegrator()->preprocess(scene);
 
-    /* Create a block generator (i.e. a work scheduler) */
-    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
+    /* Determine the filename of the output bitmap */
+    std::string outputName = getOutputName(filename);
+
+    /* Wall-clock budget in milliseconds (the command line overrides the scene) */
+    double budget = 1000.0 * (timeLimit > 0 ? timeLimit : scene->getTimeLimit());
+
+    /* Split the pixel samples into passes over the entire image. Unless
+       rendering progressively, all samples are taken in a single pass.
+       Adaptive sampling needs several passes, by default each of them
+       takes the minimum number of samples per pixel. With a time budget,
+       passes (of one sample per pixel by default) are rendered until it
+       is used up, and the sample count only limits adaptive sampling */
+    const Sampler *sceneSampler = scene->getSampler();
+    uint32_t sampleCount = (uint32_t) sceneSampler->getSampleCount();
+    bool unbounded = budget > 0 && !sceneSampler->isAdaptive();
+    uint32_t passSampleCount = sampleCount;
+    if (progressive > 0)
+        passSampleCount = unbounded ? (uint32_t) progressive
+                                    : std::min((uint32_t) progressive, sampleCount);
+    else if (sceneSampler->isAdaptive())
+        passSampleCount = (uint32_t) sceneSampler->getMinSampleCount();
+    else if (budget > 0)
+        passSampleCount = 1;
+    else if (checkpoint)
+        passSampleCount = std::max(1u, (sampleCount + NORI_CHECKPOINT_PASSES - 1) / NORI_CHECKPOINT_PASSES);
+    uint32_t passCount = unbounded ? std::numeric_limits<uint32_t>::max()
+                                   : (sampleCount + passSampleCount - 1) / passSampleCount;
+
+    /* Per-pixel error estimates for adaptive sampling */
+    std::unique_ptr<SampleStatistics> stats;
+    if (sceneSampler->isAdaptive())
+        stats.reset(new SampleStatistics(outputSize));
+
+    /* Hand out the blocks to worker processes instead of rendering them here */
+    std::unique_ptr<RenderCoordinator> coordinator;
+    if (listenPort > 0) {
+        if (stats)
+            throw NoriException("Adaptive sampling cannot be combined with distributed rendering!");
+        coordinator.reset(new RenderCoordinator(listenPort, scene));
+    }
+
+    /* Alternatively, render breadth-first instead of one sample at a time */
+    std::unique_ptr<WavefrontRenderer> wavefrontRenderer;
+    if (wavefront && !coordinator) {
+        if (stats)
+            throw NoriException("Adaptive sampling cannot be combined with wavefront rendering!");
+        wavefrontRenderer.reset(new WavefrontRenderer(scene));
+    }
 
     /* Allocate memory for the entire output image and clear it */
     ImageBlock result(outputSize, camera->getReconstructionFilter());
     result.clear();
 
+    /* Auxiliary images rendered from the same camera rays */
+    std::unique_ptr<AOVBuffer> aovResult;
+    if (aovMask) {
+        if (coordinator || wavefrontRenderer || checkpoint)
+            throw NoriException("AOVs cannot be combined with distributed, wavefront or checkpointed rendering!");
+        aovResult.reset(new AOVBuffer(aovMask, outputSize, camera->getReconstructionFilter()));
+    }
+
+    /* Only render the crop window (the command line overrides the camera),
+       plus a margin that provides its edge pixels with the samples in
+       their full filter footprint */
+    BoundingBox2i fullImage(Point2i(0, 0), Point2i(outputSize.x(), outputSize.y()));
+    BoundingBox2i crop = cropWindow.getVolume() > 0 ? cropWindow : camera->getCropWindow();
+    crop.clip(fullImage);
+    if (!crop.isValid() || crop.getVolume() == 0)
+        throw NoriException("The crop window does not overlap the image!");
+    bool cropped = !(crop == fullImage);
+    if (cropped && aovResult)
+        throw NoriException("AOVs cannot be combined with crop windows!");
+    BoundingBox2i renderWindow(crop.min - Vector2i::Constant(result.getBorderSize()),
+                               crop.max + Vector2i::Constant(result.getBorderSize()));
+    renderWindow.clip(fullImage);
+    Vector2i cropSize = crop.getExtents();
+
+    /* Optionally paste the crop window into the previous output */
+    std::unique_ptr<Bitmap> spliceTarget;
+    if (cropped && splice) {
+        spliceTarget.reset(new Bitmap(outputName + ".exr"));
+        if (spliceTarget->cols() != outputSize.x() || spliceTarget->rows() != outputSize.y())
+            throw NoriException("Can't splice into \"%s.exr\": it has a different resolution!", outputName);
+    }
+
+    /* Turn the accumulated samples into the image that is written to disk */
+    auto develop = [&]() {
+        std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+        if (!cropped)
+            return bitmap;
+
+        std::unique_ptr<Bitmap> output;
+        if (spliceTarget) {
+            output.reset(new Bitmap(*spliceTarget));
+            output->block(crop.min.y(), crop.min.x(), cropSize.y(), cropSize.x()) =
+                bitmap->block(crop.min.y(), crop.min.x(), cropSize.y(), cropSize.x());
+        } else {
+            output.reset(new Bitmap(cropSize));
+            output->block(0, 0, cropSize.y(), cropSize.x()) =
+                bitmap->block(crop.min.y(), crop.min.x(), cropSize.y(), cropSize.x());
+            output->setMetadata("cropWindow", tfm::format("%i %i %i %i",
+                crop.min.x(), crop.min.y(), cropSize.x(), cropSize.y()));
+        }
+        return output;
+    };
+
+    /* Continue from the passes stored in an earlier checkpoint */
+    std::string checkpointName = outputName + ".ckpt";
+    RenderProgress progress;
+    progress.sampleCount = sampleCount;
+    progress.passSampleCount = passSampleCount;
+    if (resume) {
+        if (loadCheckpoint(checkpointName, progress, crop, result, stats.get()))
+            cout << "Resuming from \"" << checkpointName << "\" after "
+                 << progress.passesDone << " passes .." << endl;
+        else
+            cout << "No checkpoint \"" << checkpointName << "\" found, starting from scratch .." << endl;
+    }
+
+    /* Without a preview window, nobody needs a consistent view of the
+       image while rendering. Merge blocks without a global lock then */
+    if (!gui) {
+        result.setStripedLocking(true);
+        if (aovResult)
+            aovResult->setStripedLocking(true);
+    }
+
     /* Create a window that visualizes the partially rendered result */
     NoriScreen *screen = nullptr;
     if (gui) {
@@ -86,54 +338,174 @@ static void render(Scene *scene, const std::string &filename) {
         screen = new NoriScreen(result);
     }
 
+    /* Pressing Ctrl-C once finishes the current pass and stops rendering */
+    stopRender = false;
+    std::signal(SIGINT, [](int) {
+        stopRender = true;
+        std::signal(SIGINT, SIG_DFL);
+    });
+    uint32_t &passesDone = progress.passesDone, &samplesPerPixel = progress.samplesPerPixel;
+    bool converged = false, outOfTime = false;
+    double renderTime = 0;
+
     /* Do the following in parallel and asynchronously */
     std::thread render_thread([&] {
         tbb::global_control gc(tbb::global_control::max_allowed_parallelism, threadCount);
 
         cout << "Rendering .. ";
         cout.flush();
-        Timer timer;
+        Timer timer, snapshotTimer;
+        double elapsedBefore = progress.elapsed;
 
-        tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+        auto writeCheckpoint = [&]() {
+            try {
+                saveCheckpoint(checkpointName, progress, crop, result, stats.get());
+            } catch (const std::exception &e) {
+                cerr << e.what() << endl;
+            }
+        };
+
+        for (uint32_t pass = passesDone; pass < passCount; ++pass) {
+            uint32_t count = unbounded ? passSampleCount
+                : std::min(passSampleCount, sampleCount - pass * passSampleCount);
+            std::atomic<size_t> samplesTaken(0);
+
+            /* Create a block generator (i.e. a work scheduler) */
+            BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE, blockOrder, renderWindow);
+
+            tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+
+            auto map = [&](const tbb::blocked_range<int> &range) {
+                /* Allocate memory for a small image block to be rendered
+                   by the current thread */
+                ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
+                    camera->getReconstructionFilter());
+
+                /* Create a clone of the sampler for the current thread */
+                std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+
+                /* .. and storage for the AOVs of the block */
+                std::unique_ptr<AOVBuffer> blockAOVs;
+                if (aovResult)
+                    blockAOVs.reset(new AOVBuffer(aovMask, Vector2i(NORI_BLOCK_SIZE),
+                                                  camera->getReconstructionFilter()));
 
-        auto map = [&](const tbb::blocked_range<int> &range) {
-            /* Allocate memory for a small image block to be rendered
-               by the current thread */
-            ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
-                camera->getReconstructionFilter());
+                for (int i=range.begin(); i<range.end(); ++i) {
+                    /* Skip the remaining blocks if rendering was cancelled */
+                    if (abortRender)
+                        break;
 
-            /* Create a clone of the sampler for the current thread */
-            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+                    /* Request an image block from the block generator */
+                    blockGenerator.next(block);
 
-            for (int i=range.begin(); i<range.end(); ++i) {
-                /* Request an image block from the block generator */
-                blockGenerator.next(block);
+                    /* Inform the sampler about the block to be rendered */
+                    sampler->prepare(block, pass);
+                    if (blockAOVs)
+                        blockAOVs->prepare(block, pass);
 
-                /* Inform the sampler about the block to be rendered */
-                sampler->prepare(block);
+                    /* Render all contained pixels */
+                    samplesTaken += renderBlock(scene, sampler.get(), block, count, stats.get(),
+                                                nullptr, blockAOVs.get());
 
-                /* Render all contained pixels */
-                renderBlock(scene, sampler.get(), block);
+                    /* The image block has been processed. Now add it to
+                       the "big" block that represents the entire image */
+                    result.put(block);
+                    if (aovResult)
+                        aovResult->put(*blockAOVs);
+                }
+            };
 
-                /* The image block has been processed. Now add it to
-                   the "big" block that represents the entire image */
-                result.put(block);
+            if (coordinator) {
+                /* Let the workers render the blocks of this pass. Without
+                   workers, a stop request abandons the partial pass, which
+                   leaves the image with the completed passes */
+                if (!coordinator->renderPass(blockGenerator, pass, count, result,
+                                             abortRender, stopRender)) {
+                    if (!abortRender && checkpoint)
+                        writeCheckpoint();
+                    break;
+                }
+                samplesTaken = (size_t) count * outputSize.x() * outputSize.y();
+            } else if (wavefrontRenderer) {
+                wavefrontRenderer->renderPass(blockGenerator, pass, count, result, abortRender);
+                samplesTaken = (size_t) count * outputSize.x() * outputSize.y();
+            } else {
+                /// Default: parallel rendering
+                tbb::parallel_for(range, map);
+
+                /// (equivalent to the following single-threaded call)
+                // map(range);
             }
-        };
 
-        /// Default: parallel rendering
-        tbb::parallel_for(range, map);
+            if (abortRender)
+                break;
+            ++passesDone;
+            samplesPerPixel += count;
+            progress.elapsed = elapsedBefore + timer.elapsed();
+
+            /* With adaptive sampling, all pixels may converge early */
+            if (samplesTaken == 0) {
+                converged = true;
+                break;
+            }
 
-        /// (equivalent to the following single-threaded call)
-        // map(range);
+            if (passesDone == passCount)
+                break;
 
-        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+            /* Don't start a pass that is not expected to finish in time */
+            if (budget > 0 && progress.elapsed + progress.elapsed / passesDone > budget)
+                outOfTime = true;
+
+            /* Stop early if the user is happy with the current state */
+            bool stopping = stopRender || outOfTime;
+
+            /* Periodically write the converging image to disk. When
+               stopping, leave a checkpoint to resume from */
+            if (snapshotTimer.elapsed() > NORI_SNAPSHOT_INTERVAL ||
+                (stopping && checkpoint)) {
+                if (checkpoint)
+                    writeCheckpoint();
+                if (!stopping) {
+                    result.lock();
+                    std::unique_ptr<Bitmap> snapshot(develop());
+                    result.unlock();
+                    snapshot->setMetadata("passes", std::to_string(passesDone));
+                    snapshot->saveEXR(outputName, exrOptions);
+                }
+                snapshotTimer.reset();
+            }
+
+            if (stopping)
+                break;
+        }
+
+        renderTime = elapsedBefore + timer.elapsed();
+        if (abortRender)
+            cout << "aborted. (after " << timer.elapsedString() << ")" << endl;
+        else if (outOfTime)
+            cout << "time limit reached after " << passesDone << " passes and "
+                 << samplesPerPixel << " spp. (took " << timer.elapsedString() << ")" << endl;
+        else if (converged)
+            cout << "converged after " << passesDone << "/" << passCount
+                 << " passes. (took " << timer.elapsedString() << ")" << endl;
+        else if (unbounded)
+            cout << "stopped after " << passesDone << " passes and " << samplesPerPixel
+                 << " spp. (took " << timer.elapsedString() << ")" << endl;
+        else if (passesDone < passCount)
+            cout << "stopped after " << passesDone << "/" << passCount
+                 << " passes. (took " << timer.elapsedString() << ")" << endl;
+        else
+            cout << "done. (took " << timer.elapsedString() << ")" << endl;
     });
 
     /* Enter the application main loop */
-    if (gui)
+    if (gui) {
         nanogui::mainloop(50.f);
 
+        /* Closing the window finishes the current pass and stops rendering */
+        stopRender = true;
+    }
+
     /* Shut down the user interface */
     render_thread.join();
 
@@ -142,31 +514,255 @@ static void render(Scene *scene, const std::string &filename) {
         nanogui::shutdown();
     }
 
-    /* Now turn the rendered image block into
-       a properly normalized bitmap */
-    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+    std::signal(SIGINT, SIG_DFL);
 
-    /* Determine the filename of the output bitmap */
-    std::string outputName = filename;
-    size_t lastdot = outputName.find_last_of(".");
-    if (lastdot != std::string::npos)
-        outputName.erase(lastdot, std::string::npos);
+    /* Don't overwrite earlier results with a partial image */
+    if (abortRender || passesDone == 0)
+        return;
+
+    /* A finished render no longer needs its checkpoint */
+    if (checkpoint && (converged || passesDone == passCount))
+        std::remove(checkpointName.c_str());
+
+    /* Now normalize the rendered image block (under its lock, like the
+       snapshots). Unless only a crop window was rendered, the image is
+       written straight from the block */
+    std::unique_ptr<Bitmap> bitmap;
+    result.lock();
+    if (cropped)
+        bitmap = develop();
+    else
+        result.normalize();
+    result.unlock();
+    BitmapView output = bitmap ? bitmap->view() : result.getView();
+    if (aovResult)
+        aovResult->normalize();
+
+    /* Filter the noise using the AOVs as guides, and keep the
+       unfiltered image as an extra layer of the EXR file */
+    std::unique_ptr<Bitmap> denoised;
+    if (denoiseOutput) {
+        cout << "Denoising .. ";
+        cout.flush();
+        Timer timer;
+        denoised.reset(denoise(output, *aovResult, samplesPerPixel, stats.get()));
+        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+
+        BitmapView noisy = output;
+        output = denoised->view();
+        output.addLayer("noisy", noisy);
+    }
+    if (aovResult)
+        aovResult->addLayers(output);
+
+    /* Record how many samples were actually taken */
+    output.setMetadata("renderTime", timeString(renderTime, true));
+    output.setMetadata("passes", std::to_string(passesDone));
+    if (stats) {
+        uint32_t minCount = std::numeric_limits<uint32_t>::max(), maxCount = 0;
+        double totalCount = 0;
+        for (int y=crop.min.y(); y<crop.max.y(); ++y) {
+            for (int x=crop.min.x(); x<crop.max.x(); ++x) {
+                uint32_t count = stats->getSampleCount(Point2i(x, y));
+                minCount = std::min(minCount, count);
+                maxCount = std::max(maxCount, count);
+                totalCount += count;
+            }
+        }
+        output.setMetadata("samplesPerPixel", tfm::format("%.2f",
+            totalCount / ((double) cropSize.x() * cropSize.y())));
+        output.setMetadata("minSamplesPerPixel", std::to_string(minCount));
+        output.setMetadata("maxSamplesPerPixel", std::to_string(maxCount));
+    } else {
+        output.setMetadata("samplesPerPixel", std::to_string(samplesPerPixel));
+    }
 
     /* Save using the OpenEXR format */
-    bitmap->saveEXR(outputName);
+    output.saveEXR(outputName, exrOptions);
 
     /* Save tonemapped (sRGB) output using the PNG format */
-    bitmap->savePNG(outputName);
+    output.savePNG(outputName);
+}
+
+/**
+ * \brief Render a scene and re-render it whenever one of its files changes
+ *
+ * A background thread polls the modification times of the XML file and of
+ * the OBJ files that the scene loaded. When one of them changes, the current
+ * render is aborted and the scene is reloaded while the previous version is
+ * still alive. Meshes that did not change therefore find their geometry and
+ * octree in the geometry cache, and only the modified objects (camera,
+ * BSDFs, edited meshes, ..) are actually rebuilt.
+ */
+static void watchScene(const std::string &filename) {
+    typedef std::vector<std::pair<std::string, std::filesystem::file_time_type>> FileList;
+
+    /* Record the current modification times of the given files */
+    auto snapshot = [](const std::vector<std::string> &names) {
+        FileList files;
+        for (const std::string &name : names) {
+            std::error_code ec;
+            std::filesystem::file_time_type time =
+                std::filesystem::last_write_time(name, ec);
+            if (!ec)
+                files.emplace_back(name, time);
+        }
+        return files;
+    };
+
+    std::mutex mutex;
+    FileList watched = snapshot({ filename });
+    std::atomic<bool> changed(false), done(false);
+
+    std::thread watcher([&] {
+        while (!done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            std::lock_guard<std::mutex> guard(mutex);
+            for (auto &file : watched) {
+                std::error_code ec;
+                std::filesystem::file_time_type time =
+                    std::filesystem::last_write_time(file.first, ec);
+                if (ec || time == file.second)
+                    continue;
+                file.second = time;
+                changed = true;
+            }
+            if (changed) {
+                abortRender = true;
+                if (gui)
+                    nanogui::leave();
+            }
+        }
+    });
+
+    std::unique_ptr<NoriObject> root;
+    while (true) {
+        changed = false;
+        abortRender = false;
+
+        bool loaded = false;
+        try {
+            std::unique_ptr<NoriObject> newRoot(loadScene(filename));
+            root = std::move(newRoot);
+            loaded = true;
+        } catch (const std::exception &e) {
+            cerr << e.what() << endl;
+        }
+
+        if (loaded && root->getClassType() == NoriObject::EScene) {
+            /* OBJ meshes are named after the file they were resolved to */
+            std::vector<std::string> names { filename };
+            for (const Mesh *mesh : static_cast<Scene *>(root.get())->getMeshes())
+                names.push_back(mesh->getName());
+            FileList files = snapshot(names);
+            std::lock_guard<std::mutex> guard(mutex);
+            watched = std::move(files);
+        }
+
+        if (loaded && root->getClassType() == NoriObject::EScene) {
+            try {
+                render(static_cast<Scene *>(root.get()), filename);
+            } catch (const std::exception &e) {
+                cerr << e.what() << endl;
+            }
+        }
+
+        if (!changed) {
+            /* The user closed the preview window */
+            if (gui && loaded)
+                break;
+
+            cout << "Waiting for changes to \"" << filename << "\" or its meshes .." << endl;
+            while (!changed)
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        cout << "Reloading \"" << filename << "\" .." << endl;
+    }
+
+    done = true;
+    watcher.join();
+}
+
+/**
+ * \brief Render a sequence of scenes in a single process
+ *
+ * While a scene renders, the next one is already being loaded on another
+ * thread. Since the current scene is still alive at that point, meshes that
+ * the two scenes share are found in the geometry cache along with their
+ * octrees. Scenes that fail to load or render are skipped.
+ *
+ * \return The number of scenes that could not be rendered
+ */
+static int renderBatch(const std::vector<std::string> &filenames) {
+    auto load = [](const std::string &filename) {
+        return std::unique_ptr<NoriObject>(loadScene(filename));
+    };
+
+    std::future<std::unique_ptr<NoriObject>> next =
+        std::async(std::launch::async, load, filenames[0]);
+    int failed = 0;
+    Timer timer;
+
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        cout << "Batch: scene " << (i + 1) << "/" << filenames.size()
+             << " (\"" << filenames[i] << "\")" << endl;
+
+        std::unique_ptr<NoriObject> root;
+        try {
+            root = next.get();
+        } catch (const std::exception &e) {
+            cerr << e.what() << endl;
+        }
+
+        /* Start loading the following scene */
+        if (i + 1 < filenames.size())
+            next = std::async(std::launch::async, load, filenames[i + 1]);
+
+        if (!root || root->getClassType() != NoriObject::EScene) {
+            ++failed;
+            continue;
+        }
+
+        try {
+            render(static_cast<Scene *>(root.get()), filenames[i]);
+        } catch (const std::exception &e) {
+            cerr << e.what() << endl;
+            ++failed;
+        }
+
+        /* Keep the scene alive until the next one has been loaded */
+        if (next.valid())
+            next.wait();
+
+        if (stopRender)
+            break;
+    }
+
+    cout << "Batch: rendered " << (filenames.size() - failed) << "/" << filenames.size()
+         << " scenes. (took " << timer.elapsedString() << ")" << endl;
+    return failed;
 }
 
 int main(int argc, char **argv) {
     if (argc < 2) {
-        cerr << "Syntax: " << argv[0] << " <scene.xml> [--no-gui] [--threads N]" <<  endl;
+        cerr << "Syntax: " << argv[0] << " <scene.xml> [--no-gui] [--threads N] [--watch]"
+             " [--tile-order spiral|hilbert|scanline] [--progressive N]"
+             " [--time-limit SECONDS] [--checkpoint] [--resume]"
+             " [--listen PORT | --connect HOST:PORT] [--wavefront]"
+             " [--batch FILE] [--frames FIRST:LAST]"
+             " [--crop X,Y,WIDTH,HEIGHT [--splice]]"
+             " [--exr-half] [--exr-tiles SIZE] [--exr-compression CODEC] [--stream]"
+             " [--aovs albedo,normal,depth,ao,variance] [--denoise]\n"
+             "       " << argv[0] << " --server [--threads N]\n"
+             "With --aovs, integrators that don't support --wavefront intersect every"
+             " camera ray twice (once for the image and once for the AOVs)." <<  endl;
         return -1;
     }
 
-    std::string sceneName = "";
+    std::vector<std::string> sceneNames;
     std::string exrName = "";
+    int firstFrame = 0, lastFrame = -1;
+    bool customOrder = false;
 
     for (int i = 1; i < argc; ++i) {
         std::string token(argv[i]);
@@ -188,17 +784,194 @@ int main(int argc, char **argv) {
             gui = false;
             continue;
         }
+        else if (token == "--watch") {
+            watch = true;
+            continue;
+        }
+        else if (token == "--listen") {
+            if (i+1 >= argc) {
+                cerr << "\"--listen\" argument expects a port number following it." << endl;
+                return -1;
+            }
+            listenPort = atoi(argv[i+1]);
+            i++;
+            if (listenPort <= 0 || listenPort > 65535) {
+                cerr << "\"--listen\" argument expects a port number following it." << endl;
+                return -1;
+            }
+
+            continue;
+        }
+        else if (token == "--connect") {
+            if (i+1 >= argc) {
+                cerr << "\"--connect\" argument expects an address (host:port) following it." << endl;
+                return -1;
+            }
+            coordinatorAddress = argv[++i];
+            continue;
+        }
+        else if (token == "--server") {
+            server = true;
+            continue;
+        }
+        else if (token == "--crop") {
+            Point2i offset;
+            Vector2i size;
+            if (i+1 >= argc || sscanf(argv[i+1], "%i,%i,%i,%i", &offset.x(), &offset.y(),
+                                      &size.x(), &size.y()) != 4 ||
+                (offset.array() < 0).any() || (size.array() <= 0).any()) {
+                cerr << "\"--crop\" argument expects a pixel rectangle (X,Y,WIDTH,HEIGHT) following it." << endl;
+                return -1;
+            }
+            cropWindow = BoundingBox2i(offset, offset + size);
+            i++;
+            continue;
+        }
+        else if (token == "--splice") {
+            splice = true;
+            continue;
+        }
+        else if (token == "--wavefront") {
+            wavefront = true;
+            continue;
+        }
+        else if (token == "--batch") {
+            if (i+1 >= argc) {
+                cerr << "\"--batch\" argument expects a file with one scene per line following it." << endl;
+                return -1;
+            }
+            std::ifstream is(argv[++i]);
+            if (is.fail()) {
+                cerr << "Unable to open the batch file \"" << argv[i] << "\"" << endl;
+                return -1;
+            }
+            std::string line;
+            while (std::getline(is, line)) {
+                size_t first = line.find_first_not_of(" \t\r");
+                if (first == std::string::npos || line[first] == '#')
+                    continue;
+                line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+                sceneNames.push_back(line);
+            }
+            continue;
+        }
+        else if (token == "--frames") {
+            if (i+1 >= argc || sscanf(argv[i+1], "%i:%i", &firstFrame, &lastFrame) != 2 ||
+                firstFrame > lastFrame) {
+                cerr << "\"--frames\" argument expects a frame range (FIRST:LAST) following it." << endl;
+                return -1;
+            }
+            i++;
+            continue;
+        }
+        else if (token == "--checkpoint") {
+            checkpoint = true;
+            continue;
+        }
+        else if (token == "--resume") {
+            checkpoint = resume = true;
+            continue;
+        }
+        else if (token == "--progressive") {
+            if (i+1 >= argc) {
+                cerr << "\"--progressive\" argument expects a positive integer following it." << endl;
+                return -1;
+            }
+            progressive = atoi(argv[i+1]);
+            i++;
+            if (progressive <= 0) {
+                cerr << "\"--progressive\" argument expects a positive integer following it." << endl;
+                return -1;
+            }
+
+            continue;
+        }
+        else if (token == "--time-limit") {
+            if (i+1 >= argc) {
+                cerr << "\"--time-limit\" argument expects a positive number of seconds following it." << endl;
+                return -1;
+            }
+            timeLimit = (float) atof(argv[i+1]);
+            i++;
+            if (timeLimit <= 0) {
+                cerr << "\"--time-limit\" argument expects a positive number of seconds following it." << endl;
+                return -1;
+            }
+
+            continue;
+        }
+        else if (token == "--aovs") {
+            if (i+1 >= argc) {
+                cerr << "\"--aovs\" argument expects a list of AOVs (e.g. \"albedo,normal,depth,ao,variance\") following it." << endl;
+                return -1;
+            }
+            try {
+                aovMask = AOVBuffer::parseAOVs(argv[++i]);
+            } catch (const std::exception &e) {
+                cerr << e.what() << endl;
+                return -1;
+            }
+            continue;
+        }
+        else if (token == "--denoise") {
+            denoiseOutput = true;
+            continue;
+        }
+        else if (token == "--stream") {
+            streamOutput = true;
+            continue;
+        }
+        else if (token == "--exr-half") {
+            exrOptions.half = true;
+            continue;
+        }
+        else if (token == "--exr-tiles") {
+            if (i+1 >= argc) {
+                cerr << "\"--exr-tiles\" argument expects a positive tile size following it." << endl;
+                return -1;
+            }
+            exrOptions.tileSize = atoi(argv[i+1]);
+            i++;
+            if (exrOptions.tileSize <= 0) {
+                cerr << "\"--exr-tiles\" argument expects a positive tile size following it." << endl;
+                return -1;
+            }
+
+            continue;
+        }
+        else if (token == "--exr-compression") {
+            if (i+1 >= argc) {
+                cerr << "\"--exr-compression\" argument expects a codec name (e.g. \"zip\", \"piz\" or \"dwaa\") following it." << endl;
+                return -1;
+            }
+            try {
+                exrOptions.compression = EXROptions::parseCompression(argv[++i]);
+            } catch (const std::exception &e) {
+                cerr << e.what() << endl;
+                return -1;
+            }
+            continue;
+        }
+        else if (token == "--tile-order") {
+            if (i+1 >= argc) {
+                cerr << "\"--tile-order\" argument expects \"spiral\", \"hilbert\" or \"scanline\" following it." << endl;
+                return -1;
+            }
+            try {
+                blockOrder = BlockGenerator::parseOrder(argv[++i]);
+                customOrder = true;
+            } catch (const std::exception &e) {
+                cerr << e.what() << endl;
+                return -1;
+            }
+            continue;
+        }
 
         filesystem::path path(argv[i]);
 
         try {
             if (path.extension() == "xml") {
-                sceneName = argv[i];
-
-                /* Add the parent directory of the scene file to the
-                   file resolver. That way, the XML file can reference
-                   resources (OBJ files, textures) using relative paths */
-                getFileResolver()->prepend(path.parent_path());
+                sceneNames.push_back(argv[i]);
             } else if (path.extension() == "exr") {
                 /* Alternatively, provide a basic OpenEXR image viewer */
                 exrName = argv[i];
@@ -212,11 +985,63 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (exrName !="" && sceneName !="") {
+    /* The denoiser is guided by the geometric AOVs (the depth is optional,
+       but practically free once the camera ray was intersected) */
+    if (denoiseOutput)
+        aovMask |= NORI_DENOISER_AOVS | (1u << EDepth);
+
+    if (streamOutput) {
+        if (progressive > 0 || timeLimit > 0 || checkpoint || listenPort > 0 ||
+            !coordinatorAddress.empty() || wavefront || cropWindow.getVolume() > 0 || aovMask ||
+            customOrder) {
+            cerr << "\"--stream\" renders in a single pass in scanline order and can't be combined "
+                    "with --progressive, --time-limit, --checkpoint, --resume, --listen, --connect, "
+                    "--wavefront, --crop, --aovs, --denoise or --tile-order." << endl;
+            return -1;
+        }
+        if (gui) {
+            cout << "Streaming output: disabling the preview window" << endl;
+            gui = false;
+        }
+    }
+
+    /* Let OpenEXR compress (and load) images using as many threads as the renderer */
+    Bitmap::setThreadCount(threadCount < 0 ? (int) std::thread::hardware_concurrency() : threadCount);
+
+    /* Headless server: jobs arrive on stdin, results are written to stdout */
+    if (server) {
+        if (threadCount < 0)
+            threadCount = std::thread::hardware_concurrency();
+        tbb::global_control gc(tbb::global_control::max_allowed_parallelism, threadCount);
+
+        /* Keep stdout clean for the protocol, log messages go to stderr */
+        std::ostream protocol(std::cout.rdbuf());
+        std::cout.rdbuf(std::cerr.rdbuf());
+        runServer(std::cin, protocol);
+        std::cout.rdbuf(protocol.rdbuf());
+        return 0;
+    }
+
+    /* Expand frame templates such as "scene_%04i.xml" */
+    if (lastFrame >= firstFrame) {
+        std::vector<std::string> frames;
+        for (const std::string &name : sceneNames) {
+            if (!isFrameTemplate(name)) {
+                cerr << "\"--frames\" requires scene names with a single integer "
+                        "conversion (e.g. \"scene_%04i.xml\"), got \"" << name << "\"." << endl;
+                return -1;
+            }
+            for (int frame = firstFrame; frame <= lastFrame; ++frame)
+                frames.push_back(tfm::format(name.c_str(), frame));
+        }
+        sceneNames = frames;
+    }
+
+    if (exrName !="" && !sceneNames.empty()) {
         cerr << "Both .xml and .exr files were provided. Please only provide one of them." << endl;
         return -1;
     }
-    else if (exrName == "" && sceneName == "") {
+    else if (exrName == "" && sceneNames.empty()) {
         cerr << "Please provide the path to a .xml (or .exr) file." << endl;
         return -1;
     }
@@ -239,14 +1064,36 @@ int main(int argc, char **argv) {
             return -1;
         }
     }
-    else { // sceneName != ""
+    else if (sceneNames.size() > 1) {
+        if (threadCount < 0) {
+            threadCount = std::thread::hardware_concurrency();
+        }
+        if (watch || !coordinatorAddress.empty()) {
+            cerr << "Batch rendering can't be combined with --watch or --connect." << endl;
+            return -1;
+        }
+        if (gui) {
+            cout << "Batch rendering: disabling the preview window" << endl;
+            gui = false;
+        }
+        return renderBatch(sceneNames) == 0 ? 0 : -1;
+    }
+    else { // sceneNames.size() == 1
+        const std::string &sceneName = sceneNames[0];
         if (threadCount < 0) {
             threadCount = std::thread::hardware_concurrency();
         }
+        if (watch && coordinatorAddress.empty()) {
+            watchScene(sceneName);
+            return 0;
+        }
         try {
-            std::unique_ptr<NoriObject> root(loadFromXML(sceneName));
-            /* When the XML root object is a scene, start rendering it .. */
-            if (root->getClassType() == NoriObject::EScene)
+            std::unique_ptr<NoriObject> root(loadScene(sceneName));
+            /* When the XML root object is a scene, start rendering it
+               (or render blocks for a coordinator) .. */
+            if (root->getClassType() == NoriObject::EScene && !coordinatorAddress.empty())
+                runWorker(static_cast<Scene *>(root.get()), coordinatorAddress, threadCount);
+            else if (root->getClassType() == NoriObject::EScene)
                 render(static_cast<Scene *>(root.get()), sceneName);
         } catch (const std::exception &e) {
             cerr << e.what() << endl;
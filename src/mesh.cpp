@@ -22,10 +22,12 @@
 #include <nori/emitter.h>
 #include <nori/warp.h>
 #include <Eigen/Geometry>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
 
 NORI_NAMESPACE_BEGIN
 
-Mesh::Mesh() { }
+Mesh::Mesh() : m_geometry(std::make_shared<MeshGeometry>()) { }
 
 Mesh::~Mesh() {
     delete m_bsdf;
@@ -38,19 +40,117 @@ void Mesh::activate() {
         m_bsdf = static_cast<BSDF *>(
             NoriObjectFactory::createInstance("diffuse", PropertyList()));
     }
+
+    /* The geometry may be shared with other meshes, only reorder it once */
+    if (m_reorder && !m_geometry->reordered)
+        reorder();
+
+    /* Tabulate the triangle areas for uniform surface sampling */
+    DiscretePDF &areaPDF = m_geometry->areaPDF;
+    if (areaPDF.size() != getTriangleCount()) {
+        uint32_t triangleCount = getTriangleCount();
+        std::vector<float> areas(triangleCount);
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, triangleCount),
+            [&](const tbb::blocked_range<uint32_t> &range) {
+                for (uint32_t i=range.begin(); i<range.end(); ++i)
+                    areas[i] = surfaceArea(i);
+            }
+        );
+
+        areaPDF.clear();
+        areaPDF.reserve(triangleCount);
+        for (float area : areas)
+            areaPDF.append(area);
+        areaPDF.normalize();
+    }
+}
+
+/// Insert two zero bits after each of the lower 10 bits of \c v
+static uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+void Mesh::reorder() {
+    MeshGeometry &g = *m_geometry;
+    uint32_t triangleCount = (uint32_t) g.F.cols(),
+             vertexCount = (uint32_t) g.V.cols();
+
+    /* Quantize the triangle centroids to a 1024^3 grid over the bounding box */
+    Vector3f extents = g.bbox.getExtents(), scale;
+    for (int i=0; i<3; ++i)
+        scale[i] = extents[i] > 0 ? 1023.f / extents[i] : 0.f;
+
+    std::vector<std::pair<uint32_t, uint32_t>> keys(triangleCount);
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, triangleCount),
+        [&](const tbb::blocked_range<uint32_t> &range) {
+            for (uint32_t i=range.begin(); i<range.end(); ++i) {
+                Vector3f p = (getCentroid(i) - g.bbox.min).cwiseProduct(scale);
+                uint32_t x = (uint32_t) clamp(p.x(), 0.f, 1023.f),
+                         y = (uint32_t) clamp(p.y(), 0.f, 1023.f),
+                         z = (uint32_t) clamp(p.z(), 0.f, 1023.f);
+                keys[i] = std::make_pair(
+                    (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z), i);
+            }
+        }
+    );
+    tbb::parallel_sort(keys.begin(), keys.end());
+
+    /* Renumber the vertices in order of their first use */
+    std::vector<uint32_t> vertexMap(vertexCount, (uint32_t) -1);
+    uint32_t nextVertex = 0;
+    MatrixXu F(3, triangleCount);
+    for (uint32_t i=0; i<triangleCount; ++i) {
+        for (int k=0; k<3; ++k) {
+            uint32_t &index = vertexMap[g.F(k, keys[i].second)];
+            if (index == (uint32_t) -1)
+                index = nextVertex++;
+            F(k, i) = index;
+        }
+    }
+
+    /* Unreferenced vertices go to the end */
+    for (uint32_t i=0; i<vertexCount; ++i) {
+        if (vertexMap[i] == (uint32_t) -1)
+            vertexMap[i] = nextVertex++;
+    }
+
+    auto permute = [&](MatrixXf &M) {
+        if (M.size() == 0)
+            return;
+        MatrixXf result(M.rows(), M.cols());
+        for (uint32_t i=0; i<vertexCount; ++i)
+            result.col(vertexMap[i]) = M.col(i);
+        M.swap(result);
+    };
+
+    permute(g.V);
+    permute(g.N);
+    permute(g.UV);
+    g.F.swap(F);
+    g.areaPDF.clear();
+    g.octree.reset();
+    g.reordered = true;
 }
 
 float Mesh::surfaceArea(uint32_t index) const {
-    uint32_t i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
+    const MatrixXf &V = m_geometry->V;
+    const MatrixXu &F = m_geometry->F;
+    uint32_t i0 = F(0, index), i1 = F(1, index), i2 = F(2, index);
 
-    const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
+    const Point3f p0 = V.col(i0), p1 = V.col(i1), p2 = V.col(i2);
 
     return 0.5f * Vector3f((p1 - p0).cross(p2 - p0)).norm();
 }
 
 bool Mesh::rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const {
-    uint32_t i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
-    const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
+    const MatrixXf &V = m_geometry->V;
+    const MatrixXu &F = m_geometry->F;
+    uint32_t i0 = F(0, index), i1 = F(1, index), i2 = F(2, index);
+    const Point3f p0 = V.col(i0), p1 = V.col(i1), p2 = V.col(i2);
 
     /* Find vectors for two edges sharing v[0] */
     Vector3f edge1 = p1 - p0, edge2 = p2 - p0;
@@ -88,17 +188,49 @@ bool Mesh::rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, fl
 }
 
 BoundingBox3f Mesh::getBoundingBox(uint32_t index) const {
-    BoundingBox3f result(m_V.col(m_F(0, index)));
-    result.expandBy(m_V.col(m_F(1, index)));
-    result.expandBy(m_V.col(m_F(2, index)));
+    const MatrixXf &V = m_geometry->V;
+    const MatrixXu &F = m_geometry->F;
+    BoundingBox3f result(V.col(F(0, index)));
+    result.expandBy(V.col(F(1, index)));
+    result.expandBy(V.col(F(2, index)));
     return result;
 }
 
 Point3f Mesh::getCentroid(uint32_t index) const {
+    const MatrixXf &V = m_geometry->V;
+    const MatrixXu &F = m_geometry->F;
     return (1.0f / 3.0f) *
-        (m_V.col(m_F(0, index)) +
-         m_V.col(m_F(1, index)) +
-         m_V.col(m_F(2, index)));
+        (V.col(F(0, index)) +
+         V.col(F(1, index)) +
+         V.col(F(2, index)));
+}
+
+void Mesh::samplePosition(const Point2f &_sample, Point3f &p, Normal3f &n, float &pdf) const {
+    const MatrixXf &V = m_geometry->V, &N = m_geometry->N;
+    const MatrixXu &F = m_geometry->F;
+    const DiscretePDF &areaPDF = m_geometry->areaPDF;
+
+    /* Pick a triangle and reuse the sample to choose a position on it */
+    Point2f sample(_sample);
+    uint32_t index = (uint32_t) areaPDF.sampleReuse(sample.x());
+
+    float su = std::sqrt(1.f - sample.x());
+    Vector3f bary(1.f - su, sample.y() * su, 0.f);
+    bary.z() = 1.f - bary.x() - bary.y();
+
+    uint32_t i0 = F(0, index), i1 = F(1, index), i2 = F(2, index);
+    const Point3f p0 = V.col(i0), p1 = V.col(i1), p2 = V.col(i2);
+
+    p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
+
+    if (N.size() > 0)
+        n = (bary.x() * N.col(i0) +
+             bary.y() * N.col(i1) +
+             bary.z() * N.col(i2)).normalized();
+    else
+        n = (p1 - p0).cross(p2 - p0).normalized();
+
+    pdf = areaPDF.getNormalization();
 }
 
 void Mesh::addChild(NoriObject *obj) {
@@ -135,8 +267,8 @@ std::string Mesh::toString() const {
         "  emitter = %s\n"
         "]",
         m_name,
-        m_V.cols(),
-        m_F.cols(),
+        m_geometry->V.cols(),
+        m_geometry->F.cols(),
         m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
         m_emitter ? indent(m_emitter->toString()) : std::string("null")
     );
@@ -76,6 +76,11 @@ public:
         return true;
     }
 
+    Color3f getAlbedo() const {
+        /* Diffuse base plus the (white) specular lobe */
+        return m_kd + Color3f(m_ks);
+    }
+
     std::string toString() const {
         return tfm::format(
             "Microfacet[\n"
@@ -17,6 +17,17 @@ public:
         Normal3f n = its.shFrame.n.cwiseAbs();
         return Color3f(n.x(), n.y(), n.z());
     }
+    bool isWavefront() const { return true; }
+    bool shade(const Scene *scene, Sampler *sampler, const Ray3f &ray, const Intersection *its,
+               Color3f &value, Ray3f &shadowRay, Color3f &shadowValue) const{
+        if(!its){
+            value = Color3f(0.0f);
+            return false;
+        }
+        Normal3f n = its->shFrame.n.cwiseAbs();
+        value = Color3f(n.x(), n.y(), n.z());
+        return false;
+    }
 
     std::string toString() const{
         return "NormalIntegrator[]";
@@ -19,8 +19,11 @@
 #include <nori/mesh.h>
 #include <nori/timer.h>
 #include <filesystem/resolver.h>
+#include <tbb/mutex.h>
 #include <unordered_map>
 #include <fstream>
+#include <filesystem>
+#include <map>
 
 NORI_NAMESPACE_BEGIN
 
@@ -30,20 +33,83 @@ NORI_NAMESPACE_BEGIN
 class WavefrontOBJ : public Mesh {
 public:
     WavefrontOBJ(const PropertyList &propList) {
-        typedef std::unordered_map<OBJVertex, uint32_t, OBJVertexHash> VertexMap;
-
         filesystem::path filename =
             getFileResolver()->resolve(propList.getString("filename"));
+        Transform trafo = propList.getTransform("toWorld", Transform());
+
+        m_name = filename.str();
+        m_reorder = propList.getBoolean("reorder", false);
+        m_geometry = lookupGeometry(filename, trafo, m_reorder);
+    }
+
+protected:
+    typedef std::map<std::string, std::weak_ptr<MeshGeometry>> GeometryCache;
+
+    /**
+     * \brief Look up the geometry of an OBJ file in a process-wide cache
+     *
+     * Entries are keyed by the absolute path of the file, its modification
+     * time (so that edited files are loaded again, e.g. by --watch), the
+     * bits of the transformation matrix and whether the mesh will be
+     * reordered (which must never happen to buffers that are in use by
+     * another mesh). The cache only holds weak references, hence the
+     * buffers are released as soon as the last mesh using them is
+     * destroyed, which also removes their entry.
+     */
+    static std::shared_ptr<MeshGeometry> lookupGeometry(const filesystem::path &filename,
+                                                        const Transform &trafo, bool reorder) {
+        static GeometryCache cache;
+        static tbb::mutex mutex;
+
+        std::string key = filename.make_absolute().str();
+        std::error_code ec;
+        auto mtime = std::filesystem::last_write_time(filename.str(), ec).time_since_epoch().count();
+        key.append(reinterpret_cast<const char *>(&mtime), sizeof(mtime));
+        key.append(reinterpret_cast<const char *>(trafo.getMatrix().data()),
+                   sizeof(float) * 16);
+        key.push_back(reorder ? 'r' : '-');
+
+        tbb::mutex::scoped_lock lock(mutex);
+        std::shared_ptr<MeshGeometry> geometry;
+        auto it = cache.find(key);
+        if (it != cache.end())
+            geometry = it->second.lock();
+
+        if (geometry) {
+            cout << "Reusing \"" << filename << "\" (V=" << geometry->V.cols()
+                 << ", F=" << geometry->F.cols() << ", shared by "
+                 << geometry.use_count() << " meshes)" << endl;
+        } else {
+            /* The entry may already belong to a newer copy of the buffers
+               by the time that the deleter runs */
+            geometry.reset(loadGeometry(filename, trafo).release(), [key](MeshGeometry *ptr) {
+                {
+                    tbb::mutex::scoped_lock lock(mutex);
+                    auto it = cache.find(key);
+                    if (it != cache.end() && it->second.expired())
+                        cache.erase(it);
+                }
+                delete ptr;
+            });
+            cache[key] = geometry;
+        }
+        return geometry;
+    }
+
+    /// Parse an OBJ file and apply the given transformation to its contents
+    static std::unique_ptr<MeshGeometry> loadGeometry(const filesystem::path &filename,
+                                                      const Transform &trafo) {
+        typedef std::unordered_map<OBJVertex, uint32_t, OBJVertexHash> VertexMap;
 
         std::ifstream is(filename.str());
         if (is.fail())
             throw NoriException("Unable to open OBJ file \"%s\"!", filename);
-        Transform trafo = propList.getTransform("toWorld", Transform());
 
         cout << "Loading \"" << filename << "\" .. ";
         cout.flush();
         Timer timer;
 
+        std::unique_ptr<MeshGeometry> geometry(new MeshGeometry());
         std::vector<Vector3f>   positions;
         std::vector<Vector2f>   texcoords;
         std::vector<Vector3f>   normals;
@@ -62,7 +128,7 @@ public:
                 Point3f p;
                 line >> p.x() >> p.y() >> p.z();
                 p = trafo * p;
-                m_bbox.expandBy(p);
+                geometry->bbox.expandBy(p);
                 positions.push_back(p);
             } else if (prefix == "vt") {
                 Point2f tc;
@@ -104,31 +170,35 @@ public:
             }
         }
 
-        m_F.resize(3, indices.size()/3);
-        memcpy(m_F.data(), indices.data(), sizeof(uint32_t)*indices.size());
+        MatrixXf &V = geometry->V, &N = geometry->N, &UV = geometry->UV;
+        MatrixXu &F = geometry->F;
+
+        F.resize(3, indices.size()/3);
+        memcpy(F.data(), indices.data(), sizeof(uint32_t)*indices.size());
 
-        m_V.resize(3, vertices.size());
+        V.resize(3, vertices.size());
         for (uint32_t i=0; i<vertices.size(); ++i)
-            m_V.col(i) = positions.at(vertices[i].p-1);
+            V.col(i) = positions.at(vertices[i].p-1);
 
         if (!normals.empty()) {
-            m_N.resize(3, vertices.size());
+            N.resize(3, vertices.size());
             for (uint32_t i=0; i<vertices.size(); ++i)
-                m_N.col(i) = normals.at(vertices[i].n-1);
+                N.col(i) = normals.at(vertices[i].n-1);
         }
 
         if (!texcoords.empty()) {
-            m_UV.resize(2, vertices.size());
+            UV.resize(2, vertices.size());
             for (uint32_t i=0; i<vertices.size(); ++i)
-                m_UV.col(i) = texcoords.at(vertices[i].uv-1);
+                UV.col(i) = texcoords.at(vertices[i].uv-1);
         }
 
-        m_name = filename.str();
-        cout << "done. (V=" << m_V.cols() << ", F=" << m_F.cols() << ", took "
+        cout << "done. (V=" << V.cols() << ", F=" << F.cols() << ", took "
              << timer.elapsedString() << " and "
-             << memString(m_F.size() * sizeof(uint32_t) +
-                          sizeof(float) * (m_V.size() + m_N.size() + m_UV.size()))
+             << memString(F.size() * sizeof(uint32_t) +
+                          sizeof(float) * (V.size() + N.size() + UV.size()))
              << ")" << endl;
+
+        return geometry;
     }
 
 protected:
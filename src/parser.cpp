@@ -21,7 +21,9 @@
 #include <Eigen/Geometry>
 #include <pugixml.hpp>
 #include <fstream>
-#include <set>
+#include <algorithm>
+#include <cstring>
+#include <map>
 
 NORI_NAMESPACE_BEGIN
 
@@ -86,45 +88,54 @@ NoriObject *loadFromXML(const std::string &filename) {
         EInvalid
     };
 
-    /* Create a mapping from tag names to tag IDs */
-    std::map<std::string, ETag> tags;
-    tags["scene"]      = EScene;
-    tags["mesh"]       = EMesh;
-    tags["bsdf"]       = EBSDF;
-    tags["emitter"]  = EEmitter;
-    tags["camera"]     = ECamera;
-    tags["medium"]     = EMedium;
-    tags["phase"]      = EPhaseFunction;
-    tags["integrator"] = EIntegrator;
-    tags["sampler"]    = ESampler;
-    tags["rfilter"]    = EReconstructionFilter;
-    tags["test"]       = ETest;
-    tags["boolean"]    = EBoolean;
-    tags["integer"]    = EInteger;
-    tags["float"]      = EFloat;
-    tags["string"]     = EString;
-    tags["point"]      = EPoint;
-    tags["vector"]     = EVector;
-    tags["color"]      = EColor;
-    tags["transform"]  = ETransform;
-    tags["translate"]  = ETranslate;
-    tags["matrix"]     = EMatrix;
-    tags["rotate"]     = ERotate;
-    tags["scale"]      = EScale;
-    tags["lookat"]     = ELookAt;
+    /* Create a mapping from tag names to tag IDs. The transparent comparator
+       allows lookups with the 'const char *' names returned by pugixml
+       without constructing temporary strings */
+    static const std::map<std::string, ETag, std::less<>> tags = {
+        { "scene",      EScene },
+        { "mesh",       EMesh },
+        { "bsdf",       EBSDF },
+        { "emitter",    EEmitter },
+        { "camera",     ECamera },
+        { "medium",     EMedium },
+        { "phase",      EPhaseFunction },
+        { "integrator", EIntegrator },
+        { "sampler",    ESampler },
+        { "rfilter",    EReconstructionFilter },
+        { "test",       ETest },
+        { "boolean",    EBoolean },
+        { "integer",    EInteger },
+        { "float",      EFloat },
+        { "string",     EString },
+        { "point",      EPoint },
+        { "vector",     EVector },
+        { "color",      EColor },
+        { "transform",  ETransform },
+        { "translate",  ETranslate },
+        { "matrix",     EMatrix },
+        { "rotate",     ERotate },
+        { "scale",      EScale },
+        { "lookat",     ELookAt }
+    };
 
     /* Helper function to check if attributes are fully specified */
-    auto check_attributes = [&](const pugi::xml_node &node, std::set<std::string> attrs) {
+    auto check_attributes = [&](const pugi::xml_node &node, std::initializer_list<const char *> attrs) {
+        size_t found = 0;
         for (auto attr : node.attributes()) {
-            auto it = attrs.find(attr.name());
-            if (it == attrs.end())
+            bool expected = std::any_of(attrs.begin(), attrs.end(),
+                [&](const char *name) { return std::strcmp(name, attr.name()) == 0; });
+            if (!expected)
                 throw NoriException("Error while parsing \"%s\": unexpected attribute \"%s\" in \"%s\" at %s",
                                     filename, attr.name(), node.name(), offset(node.offset_debug()));
-            attrs.erase(it);
+            ++found;
+        }
+        if (found != attrs.size()) {
+            for (const char *name : attrs) {
+                if (!node.attribute(name))
+                    throw NoriException("Error while parsing \"%s\": missing attribute \"%s\" in \"%s\" at %s",
+                                        filename, name, node.name(), offset(node.offset_debug()));
+            }
         }
-        if (!attrs.empty())
-            throw NoriException("Error while parsing \"%s\": missing attribute \"%s\" in \"%s\" at %s",
-                                filename, *attrs.begin(), node.name(), offset(node.offset_debug()));
     };
 
     Eigen::Affine3f transform;
@@ -37,6 +37,16 @@ public:
         m_outputSize.y() = propList.getInteger("height", 720);
         m_invOutputSize = m_outputSize.cast<float>().cwiseInverse();
 
+        /* Optional crop window in pixels. Default: the entire image */
+        Point2i cropOffset(propList.getInteger("cropOffsetX", 0),
+                           propList.getInteger("cropOffsetY", 0));
+        Vector2i cropSize(propList.getInteger("cropWidth", m_outputSize.x() - cropOffset.x()),
+                          propList.getInteger("cropHeight", m_outputSize.y() - cropOffset.y()));
+        m_cropWindow = BoundingBox2i(cropOffset, cropOffset + cropSize);
+        if ((cropOffset.array() < 0).any() || (cropSize.array() <= 0).any() ||
+            (m_cropWindow.max.array() > m_outputSize.array()).any())
+            throw NoriException("PerspectiveCamera: the crop window must lie within the image!");
+
         /* Specifies an optional camera-to-world transformation. Default: none */
         m_cameraToWorld = propList.getTransform("toWorld", Transform());
 
@@ -108,6 +118,8 @@ public:
         return Color3f(1.0f);
     }
 
+    float getFov() const { return m_fov; }
+
     void addChild(NoriObject *obj) {
         switch (obj->getClassType()) {
             case EReconstructionFilter:
@@ -128,12 +140,14 @@ public:
             "PerspectiveCamera[\n"
             "  cameraToWorld = %s,\n"
             "  outputSize = %s,\n"
+            "  cropWindow = %s,\n"
             "  fov = %f,\n"
             "  clip = [%f, %f],\n"
             "  rfilter = %s\n"
             "]",
             indent(m_cameraToWorld.toString(), 18),
             m_outputSize.toString(),
+            m_cropWindow.toString(),
             m_fov,
             m_nearClip,
             m_farClip,
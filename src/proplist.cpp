@@ -20,33 +20,52 @@
 
 NORI_NAMESPACE_BEGIN
 
+const PropertyList::Property *PropertyList::find(const std::string &name) const {
+    size_t hash = std::hash<std::string>()(name);
+    for (const Entry &entry : m_properties) {
+        if (entry.hash == hash && entry.name == name)
+            return &entry.property;
+    }
+    return nullptr;
+}
+
+PropertyList::Property &PropertyList::insert(const std::string &name) {
+    if (const Property *prop = find(name)) {
+        cerr << "Property \"" << name <<  "\" was specified multiple times!" << endl;
+        return const_cast<Property &>(*prop);
+    }
+    m_properties.emplace_back();
+    Entry &entry = m_properties.back();
+    entry.hash = std::hash<std::string>()(name);
+    entry.name = name;
+    return entry.property;
+}
+
 #define DEFINE_PROPERTY_ACCESSOR(Type, TypeName, XmlName) \
     void PropertyList::set##TypeName(const std::string &name, const Type &value) { \
-        if (m_properties.find(name) != m_properties.end()) \
-            cerr << "Property \"" << name <<  "\" was specified multiple times!" << endl; \
-        auto &prop = m_properties[name]; \
+        auto &prop = insert(name); \
         prop.value.XmlName##_value = value; \
         prop.type = Property::XmlName##_type; \
     } \
     \
     Type PropertyList::get##TypeName(const std::string &name) const { \
-        auto it = m_properties.find(name); \
-        if (it == m_properties.end()) \
+        const Property *prop = find(name); \
+        if (!prop) \
             throw NoriException("Property '%s' is missing!", name); \
-        if (it->second.type != Property::XmlName##_type) \
+        if (prop->type != Property::XmlName##_type) \
             throw NoriException("Property '%s' has the wrong type! " \
                 "(expected <" #XmlName ">)!", name); \
-        return it->second.value.XmlName##_value; \
+        return prop->value.XmlName##_value; \
     } \
     \
     Type PropertyList::get##TypeName(const std::string &name, const Type &defVal) const { \
-        auto it = m_properties.find(name); \
-        if (it == m_properties.end()) \
+        const Property *prop = find(name); \
+        if (!prop) \
             return defVal; \
-        if (it->second.type != Property::XmlName##_type) \
+        if (prop->type != Property::XmlName##_type) \
             throw NoriException("Property '%s' has the wrong type! " \
                 "(expected <" #XmlName ">)!", name); \
-        return it->second.value.XmlName##_value; \
+        return prop->value.XmlName##_value; \
     }
 
 DEFINE_PROPERTY_ACCESSOR(bool, Boolean, boolean)
@@ -0,0 +1,140 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/render.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <nori/bsdf.h>
+#include <nori/warp.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Compute the radiance of an intersected camera ray using \ref Integrator::shade()
+static Color3f shade(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                     const Intersection *its) {
+    Color3f value, shadowValue;
+    Ray3f shadowRay;
+    if (scene->getIntegrator()->shade(scene, sampler, ray, its, value, shadowRay, shadowValue)
+            && !scene->rayIntersect(shadowRay))
+        value += shadowValue;
+    return value;
+}
+
+/**
+ * \brief Evaluate the enabled AOVs for a camera ray with radiance \c value
+ * (the geometric ones are zero if it escaped)
+ */
+static void evalAOVs(const Scene *scene, AOVBuffer &aovs, const Intersection *its,
+                     const Color3f &value, AOVRecord &record) {
+    /* Luminance and its square, see AOVBuffer::normalize() */
+    float lum = value.getLuminance();
+    record.value[EVariance] = Color3f(lum, lum * lum, 0.0f);
+
+    if (!its)
+        return;
+
+    const BSDF *bsdf = its->mesh->getBSDF();
+    const Normal3f &n = its->shFrame.n;
+    record.value[EAlbedo] = bsdf ? bsdf->getAlbedo() : Color3f(0.0f);
+    record.value[ENormal] = Color3f(n.x(), n.y(), n.z());
+    record.value[EDepth] = Color3f(its->t);
+
+    /* Only spend an occlusion ray when the AO is actually needed */
+    if (aovs.has(EAmbientOcclusion)) {
+        Vector3f d = its->shFrame.toWorld(
+            Warp::squareToCosineHemisphere(aovs.nextAOSample()));
+        record.value[EAmbientOcclusion] =
+            Color3f(scene->rayIntersect(Ray3f(its->p, d)) ? 0.0f : 1.0f);
+    }
+}
+
+size_t renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block,
+                   uint32_t sampleCount, SampleStatistics *stats,
+                   const Camera *camera, AOVBuffer *aovs) {
+    if (!camera)
+        camera = scene->getCamera();
+    const Integrator *integrator = scene->getIntegrator();
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+    size_t samplesTaken = 0;
+
+    /* Clear the block contents */
+    block.clear();
+    if (aovs)
+        aovs->reset(offset, size);
+    bool reuseIntersection = aovs && integrator->isWavefront();
+
+    /* For each pixel and pixel sample sample */
+    for (int y=0; y<size.y(); ++y) {
+        for (int x=0; x<size.x(); ++x) {
+            Point2i pixel(x + offset.x(), y + offset.y());
+            uint32_t count = sampleCount;
+
+            if (stats) {
+                uint32_t done = stats->getSampleCount(pixel);
+                if (done >= sampler->getMinSampleCount() &&
+                    stats->getRelativeError(pixel) < sampler->getErrorThreshold())
+                    continue;
+                count = std::min(count, (uint32_t) sampler->getSampleCount() - done);
+            }
+
+            for (uint32_t i=0; i<count; ++i) {
+                Point2f pixelSample = Point2f((float) pixel.x(), (float) pixel.y()) + sampler->next2D();
+                Point2f apertureSample = sampler->next2D();
+
+                /* Sample a ray from the camera */
+                Ray3f ray;
+                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+
+                /* Compute the incident radiance. With AOVs, intersect the
+                   camera ray once for both when the integrator permits it */
+                Intersection its;
+                bool hit = false;
+                if (reuseIntersection) {
+                    hit = scene->rayIntersect(ray, its);
+                    value *= shade(scene, sampler, ray, hit ? &its : nullptr);
+                } else {
+                    value *= integrator->Li(scene, sampler, ray);
+                    if (aovs)
+                        hit = scene->rayIntersect(ray, its);
+                }
+
+                if (aovs) {
+                    AOVRecord record;
+                    evalAOVs(scene, *aovs, hit ? &its : nullptr, value, record);
+                    aovs->put(pixelSample, record);
+                }
+
+                /* Store in the image block */
+                block.put(pixelSample, value);
+
+                /* Update the per-pixel error estimate */
+                if (stats)
+                    stats->put(pixel, value);
+            }
+            samplesTaken += count;
+        }
+    }
+
+    return samplesTaken;
+}
+
+NORI_NAMESPACE_END
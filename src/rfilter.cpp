@@ -113,6 +113,8 @@ public:
     float eval(float) const {
         return 1.0f;
     }
+
+    bool isBox() const { return true; }
     
     std::string toString() const {
         return "BoxFilter[]";
@@ -25,11 +25,16 @@
 
 NORI_NAMESPACE_BEGIN
 
-Scene::Scene(const PropertyList &) {
+Scene::Scene(const PropertyList &propList) {
     m_accel = new Accel();
+    m_timeLimit = propList.getFloat("timeLimit", 0.f);
+    if (m_timeLimit < 0)
+        throw NoriException("Scene: 'timeLimit' must be nonnegative!");
 }
 
 Scene::~Scene() {
+    for (Mesh *mesh : m_meshes)
+        delete mesh;
     delete m_accel;
     delete m_sampler;
     delete m_camera;
@@ -0,0 +1,534 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/server.h>
+#include <nori/parser.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <nori/bitmap.h>
+#include <nori/render.h>
+#include <nori/timer.h>
+#include <nori/rfilter.h>
+#include <filesystem/resolver.h>
+#include <tbb/parallel_for.h>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+NORI_NAMESPACE_BEGIN
+
+/// Just enough of JSON for the job protocol
+struct JSONValue {
+    enum EType { ENull, EBoolean, ENumber, EString, EArray, EObject };
+
+    EType type = ENull;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<JSONValue> array;
+    std::map<std::string, JSONValue> object;
+
+    /// Look up a member of an object (\c nullptr if missing)
+    const JSONValue *get(const std::string &name) const {
+        auto it = object.find(name);
+        return it == object.end() ? nullptr : &it->second;
+    }
+
+    /// Return a member that must be a number
+    double getNumber(const std::string &name, double defaultValue) const {
+        const JSONValue *value = get(name);
+        if (!value)
+            return defaultValue;
+        if (value->type != ENumber)
+            throw NoriException("\"%s\" must be a number!", name);
+        return value->number;
+    }
+
+    /// Return a member that must be a string
+    std::string getString(const std::string &name, const std::string &defaultValue) const {
+        const JSONValue *value = get(name);
+        if (!value)
+            return defaultValue;
+        if (value->type != EString)
+            throw NoriException("\"%s\" must be a string!", name);
+        return value->string;
+    }
+
+    /// Return a member that must be an array of \c size numbers
+    std::vector<double> getNumbers(const std::string &name, size_t size) const {
+        const JSONValue *value = get(name);
+        std::vector<double> result;
+        if (value && value->type == EArray && value->array.size() == size) {
+            for (const JSONValue &v : value->array) {
+                if (v.type != ENumber)
+                    break;
+                result.push_back(v.number);
+            }
+        }
+        if (result.size() != size)
+            throw NoriException("\"%s\" must be an array of %i numbers!", name, size);
+        return result;
+    }
+
+    /// Serialize (only needed for echoing job IDs)
+    std::string toString() const;
+};
+
+/// Escape a string for use in a JSON document
+static std::string quote(const std::string &value) {
+    std::string result = "\"";
+    for (char c : value) {
+        switch (c) {
+            case '"':  result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            case '\t': result += "\\t"; break;
+            default:
+                if ((unsigned char) c < 0x20)
+                    result += tfm::format("\\u%04x", (int) c);
+                else
+                    result += c;
+        }
+    }
+    return result + "\"";
+}
+
+std::string JSONValue::toString() const {
+    switch (type) {
+        case EBoolean: return boolean ? "true" : "false";
+        case ENumber: return tfm::format("%.9g", number);
+        case EString: return quote(string);
+        case EArray: {
+            std::string result = "[";
+            for (size_t i = 0; i < array.size(); ++i)
+                result += (i > 0 ? "," : "") + array[i].toString();
+            return result + "]";
+        }
+        case EObject: {
+            std::string result = "{";
+            for (auto it = object.begin(); it != object.end(); ++it)
+                result += (it == object.begin() ? "" : ",") + quote(it->first)
+                    + ":" + it->second.toString();
+            return result + "}";
+        }
+        default: return "null";
+    }
+}
+
+/// Recursive descent JSON parser
+class JSONParser {
+public:
+    JSONParser(const std::string &text) : m_text(text) { }
+
+    JSONValue parse() {
+        JSONValue value = parseValue();
+        skipWhitespace();
+        if (m_pos != m_text.size())
+            error("trailing characters");
+        return value;
+    }
+protected:
+    [[noreturn]] void error(const char *what) const {
+        throw NoriException("Invalid JSON (%s at offset %i)", what, m_pos);
+    }
+
+    void skipWhitespace() {
+        while (m_pos < m_text.size() && std::isspace((unsigned char) m_text[m_pos]))
+            ++m_pos;
+    }
+
+    bool consume(const char *token) {
+        size_t length = std::strlen(token);
+        if (m_text.compare(m_pos, length, token) != 0)
+            return false;
+        m_pos += length;
+        return true;
+    }
+
+    JSONValue parseValue() {
+        skipWhitespace();
+        if (m_pos >= m_text.size())
+            error("unexpected end");
+
+        JSONValue value;
+        char c = m_text[m_pos];
+        if (c == '{') {
+            value.type = JSONValue::EObject;
+            ++m_pos;
+            skipWhitespace();
+            if (consume("}"))
+                return value;
+            do {
+                skipWhitespace();
+                std::string name = parseString();
+                skipWhitespace();
+                if (!consume(":"))
+                    error("expected ':'");
+                value.object[name] = parseValue();
+                skipWhitespace();
+            } while (consume(","));
+            if (!consume("}"))
+                error("expected '}'");
+        } else if (c == '[') {
+            value.type = JSONValue::EArray;
+            ++m_pos;
+            skipWhitespace();
+            if (consume("]"))
+                return value;
+            do {
+                value.array.push_back(parseValue());
+                skipWhitespace();
+            } while (consume(","));
+            if (!consume("]"))
+                error("expected ']'");
+        } else if (c == '"') {
+            value.type = JSONValue::EString;
+            value.string = parseString();
+        } else if (consume("true")) {
+            value.type = JSONValue::EBoolean;
+            value.boolean = true;
+        } else if (consume("false")) {
+            value.type = JSONValue::EBoolean;
+        } else if (consume("null")) {
+        } else {
+            const char *start = m_text.c_str() + m_pos;
+            char *end = nullptr;
+            value.type = JSONValue::ENumber;
+            value.number = std::strtod(start, &end);
+            if (end == start)
+                error("unexpected character");
+            m_pos += end - start;
+        }
+        return value;
+    }
+
+    std::string parseString() {
+        if (!consume("\""))
+            error("expected a string");
+        std::string result;
+        while (m_pos < m_text.size() && m_text[m_pos] != '"') {
+            char c = m_text[m_pos++];
+            if (c == '\\' && m_pos < m_text.size()) {
+                c = m_text[m_pos++];
+                switch (c) {
+                    case 'n': result += '\n'; break;
+                    case 'r': result += '\r'; break;
+                    case 't': result += '\t'; break;
+                    case 'b': result += '\b'; break;
+                    case 'f': result += '\f'; break;
+                    case 'u': {
+                        uint32_t code = parseHex4();
+                        if (code >= 0xD800 && code < 0xDC00) {
+                            /* High surrogate: must be followed by a low one */
+                            if (!consume("\\u"))
+                                error("unpaired surrogate");
+                            uint32_t low = parseHex4();
+                            if (low < 0xDC00 || low >= 0xE000)
+                                error("unpaired surrogate");
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        } else if (code >= 0xDC00 && code < 0xE000) {
+                            error("unpaired surrogate");
+                        }
+                        appendUTF8(result, code);
+                        break;
+                    }
+                    default: result += c;
+                }
+            } else {
+                result += c;
+            }
+        }
+        if (!consume("\""))
+            error("unterminated string");
+        return result;
+    }
+
+    /// Parse the four hexadecimal digits of a \c \\u escape sequence
+    uint32_t parseHex4() {
+        if (m_pos + 4 > m_text.size())
+            error("truncated escape sequence");
+        uint32_t code = 0;
+        for (int i=0; i<4; ++i) {
+            char c = m_text[m_pos++];
+            code <<= 4;
+            if (c >= '0' && c <= '9')
+                code |= (uint32_t) (c - '0');
+            else if (c >= 'a' && c <= 'f')
+                code |= (uint32_t) (c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F')
+                code |= (uint32_t) (c - 'A' + 10);
+            else
+                error("invalid escape sequence");
+        }
+        return code;
+    }
+
+    /// Append a Unicode code point to \c str using the UTF-8 encoding
+    static void appendUTF8(std::string &str, uint32_t code) {
+        if (code < 0x80) {
+            str += (char) code;
+        } else if (code < 0x800) {
+            str += (char) (0xC0 | (code >> 6));
+            str += (char) (0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            str += (char) (0xE0 | (code >> 12));
+            str += (char) (0x80 | ((code >> 6) & 0x3F));
+            str += (char) (0x80 | (code & 0x3F));
+        } else {
+            str += (char) (0xF0 | (code >> 18));
+            str += (char) (0x80 | ((code >> 12) & 0x3F));
+            str += (char) (0x80 | ((code >> 6) & 0x3F));
+            str += (char) (0x80 | (code & 0x3F));
+        }
+    }
+
+    const std::string &m_text;
+    size_t m_pos = 0;
+};
+
+/// Keeps scenes resident and processes jobs one after another
+class RenderServer {
+public:
+    RenderServer(std::ostream &out) : m_out(out) { }
+
+    /// Process a job, return \c false when the server should stop
+    bool handle(const JSONValue &job);
+protected:
+    /// Write a single line to the client
+    void send(const std::string &message) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_out << message << '\n';
+        m_out.flush();
+    }
+
+    /// Return a resident scene, loading it first if necessary
+    Scene *getScene(const std::string &filename, bool reload);
+
+    void render(const JSONValue &job, const std::string &id);
+
+    std::ostream &m_out;
+    std::mutex m_mutex;
+    std::map<std::string, std::unique_ptr<NoriObject>> m_scenes;
+};
+
+Scene *RenderServer::getScene(const std::string &filename, bool reload) {
+    auto it = m_scenes.find(filename);
+    if (it != m_scenes.end() && !reload)
+        return static_cast<Scene *>(it->second.get());
+
+    /* Resolve relative asset paths (e.g. of meshes) against the scene
+       directory, but only while this scene is loading */
+    filesystem::resolver *resolver = getFileResolver();
+    resolver->prepend(filesystem::path(filename).parent_path());
+    std::unique_ptr<NoriObject> root;
+    try {
+        root.reset(loadFromXML(filename));
+    } catch (...) {
+        resolver->erase(resolver->begin());
+        throw;
+    }
+    resolver->erase(resolver->begin());
+
+    if (root->getClassType() != NoriObject::EScene)
+        throw NoriException("\"%s\" does not describe a scene!", filename);
+
+    Scene *scene = static_cast<Scene *>(root.get());
+    scene->getIntegrator()->preprocess(scene);
+    m_scenes[filename] = std::move(root);
+    return scene;
+}
+
+bool RenderServer::handle(const JSONValue &job) {
+    std::string id = "null";
+    try {
+        if (job.type != JSONValue::EObject)
+            throw NoriException("A job must be a JSON object!");
+        if (const JSONValue *value = job.get("id"))
+            id = value->toString();
+
+        std::string type = job.getString("type", "render");
+        if (type == "quit") {
+            return false;
+        } else if (type == "unload") {
+            m_scenes.erase(job.getString("scene", ""));
+            send(tfm::format("{\"type\":\"done\",\"id\":%s}", id));
+        } else if (type == "render") {
+            render(job, id);
+        } else {
+            throw NoriException("Unknown job type \"%s\"!", type);
+        }
+    } catch (const std::exception &e) {
+        send(tfm::format("{\"type\":\"error\",\"id\":%s,\"message\":%s}", id, quote(e.what())));
+    }
+    return true;
+}
+
+void RenderServer::render(const JSONValue &job, const std::string &id) {
+    Timer timer;
+
+    std::string filename = job.getString("scene", "");
+    if (filename.empty())
+        throw NoriException("Render jobs require a \"scene\"!");
+    const JSONValue *reload = job.get("reload");
+    Scene *scene = getScene(filename, reload && reload->type == JSONValue::EBoolean && reload->boolean);
+
+    /* Optionally replace the camera (same size, field of view and filter defaults as the scene) */
+    std::unique_ptr<NoriObject> cameraOverride;
+    const Camera *camera = scene->getCamera();
+    if (const JSONValue *cam = job.get("camera")) {
+        if (cam->type != JSONValue::EObject)
+            throw NoriException("\"camera\" must be an object!");
+
+        PropertyList props;
+        props.setInteger("width", (int) cam->getNumber("width", camera->getOutputSize().x()));
+        props.setInteger("height", (int) cam->getNumber("height", camera->getOutputSize().y()));
+        if (cam->get("fov") || camera->getFov() > 0)
+            props.setFloat("fov", (float) cam->getNumber("fov", camera->getFov()));
+
+        std::vector<double> o = cam->getNumbers("origin", 3), t = cam->getNumbers("target", 3),
+                            u = cam->getNumbers("up", 3);
+        Vector3f origin((float) o[0], (float) o[1], (float) o[2]);
+        Vector3f dir = (Vector3f((float) t[0], (float) t[1], (float) t[2]) - origin).normalized();
+        Vector3f left = Vector3f((float) u[0], (float) u[1], (float) u[2]).normalized().cross(dir).normalized();
+        Vector3f newUp = dir.cross(left).normalized();
+
+        Eigen::Matrix4f trafo;
+        trafo << left, newUp, dir, origin,
+                  0, 0, 0, 1;
+        props.setTransform("toWorld", Transform(trafo));
+
+        cameraOverride.reset(NoriObjectFactory::createInstance("perspective", props));
+        /* Share the filter, which the (resident) scene camera keeps alive */
+        cameraOverride->addChild(const_cast<ReconstructionFilter *>(camera->getReconstructionFilter()));
+        cameraOverride->activate();
+        camera = static_cast<const Camera *>(cameraOverride.get());
+    }
+
+    Vector2i outputSize = camera->getOutputSize();
+    double spp = job.getNumber("spp", (double) scene->getSampler()->getSampleCount());
+    if (!(spp >= 1 && spp <= (double) std::numeric_limits<uint32_t>::max()) || spp != std::floor(spp))
+        throw NoriException("\"spp\" must be a positive integer!");
+    uint32_t sampleCount = (uint32_t) spp;
+
+    /* Region of interest (the camera's crop window by default) */
+    BoundingBox2i roi(camera->getCropWindow());
+    BoundingBox2i fullImage(Point2i(0, 0), Point2i(outputSize.x(), outputSize.y()));
+    if (job.get("roi")) {
+        std::vector<double> r = job.getNumbers("roi", 4);
+        BoundingBox2i window(Point2i((int) r[0], (int) r[1]),
+                             Point2i((int) (r[0] + r[2]), (int) (r[1] + r[3])));
+        roi = window;
+        roi.clip(fullImage);
+        if (!roi.isValid() || roi.getVolume() == 0)
+            throw NoriException("\"roi\" does not overlap the image!");
+    }
+
+    ImageBlock result(outputSize, camera->getReconstructionFilter());
+    result.clear();
+    result.setStripedLocking(true);
+
+    /* Render the region of interest along with the filter margin around it */
+    BoundingBox2i renderWindow(roi.min - Vector2i::Constant(result.getBorderSize()),
+                               roi.max + Vector2i::Constant(result.getBorderSize()));
+    renderWindow.clip(fullImage);
+
+    std::vector<std::pair<Point2i, Vector2i>> blocks;
+    {
+        BlockGenerator generator(outputSize, NORI_BLOCK_SIZE, BlockGenerator::ESpiral, renderWindow);
+        ImageBlock block(Vector2i(NORI_BLOCK_SIZE), nullptr);
+        while (generator.next(block))
+            blocks.push_back(std::make_pair(block.getOffset(), block.getSize()));
+    }
+
+    send(tfm::format("{\"type\":\"started\",\"id\":%s,\"width\":%i,\"height\":%i,\"blocks\":%i}",
+                     id, outputSize.x(), outputSize.y(), blocks.size()));
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, blocks.size(), 1),
+        [&](const tbb::blocked_range<size_t> &range) {
+            ImageBlock block(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter());
+            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                block.setOffset(blocks[i].first);
+                block.setSize(blocks[i].second);
+                sampler->prepare(block, 0);
+                renderBlock(scene, sampler.get(), block, sampleCount, nullptr, camera);
+                result.put(block);
+
+                /* Stream the block right away. Pixels near its edges only
+                   include this block's samples (the final image also has
+                   the contributions of the neighbors' filter footprints) */
+                Vector2i size = block.getSize();
+                int border = block.getBorderSize();
+                std::ostringstream oss;
+                oss << "{\"type\":\"tile\",\"id\":" << id
+                    << ",\"x\":" << block.getOffset().x() << ",\"y\":" << block.getOffset().y()
+                    << ",\"width\":" << size.x() << ",\"height\":" << size.y() << ",\"data\":[";
+                for (int y = 0; y < size.y(); ++y) {
+                    for (int x = 0; x < size.x(); ++x) {
+                        Color3f c = block(y + border, x + border).divideByFilterWeight();
+                        oss << (x + y > 0 ? "," : "") << c.r() << "," << c.g() << "," << c.b();
+                    }
+                }
+                oss << "]}";
+                send(oss.str());
+            }
+        }
+    );
+
+    std::string output = job.getString("output", "");
+    if (!output.empty()) {
+        result.normalize();
+        BitmapView view = result.getView();
+        view.setMetadata("samplesPerPixel", std::to_string(sampleCount));
+        view.saveEXR(output);
+        view.savePNG(output);
+    }
+
+    send(tfm::format("{\"type\":\"done\",\"id\":%s,\"time\":%.1f}", id, timer.elapsed()));
+}
+
+void runServer(std::istream &in, std::ostream &out) {
+    RenderServer server(out);
+    out << "{\"type\":\"ready\"}" << std::endl;
+
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        JSONValue job;
+        try {
+            job = JSONParser(line).parse();
+        } catch (const std::exception &e) {
+            out << "{\"type\":\"error\",\"id\":null,\"message\":" << quote(e.what()) << "}" << std::endl;
+            continue;
+        }
+        if (!server.handle(job))
+            break;
+    }
+}
+
+NORI_NAMESPACE_END
@@ -31,6 +31,25 @@ public:
         
         return lightGoToCamera;
     }
+    bool isWavefront() const { return true; }
+    bool shade(const Scene* scene, Sampler* sampler, const Ray3f& ray, const Intersection* its,
+               Color3f& value, Ray3f& shadowRay, Color3f& shadowValue) const{
+        value = Color3f(0.0f);
+        if(!its) return false;
+
+        Point3f dist = m_position - its->p;
+        float distSquare = dist.squaredNorm();
+        Vector3f lightDir = dist.normalized();
+
+        shadowRay = Ray3f(its->p, lightDir);
+        shadowRay.mint = Epsilon;
+        shadowRay.maxt = dist.norm();
+
+        float cosTheta = its->shFrame.n.dot(lightDir);
+        float reflecMulDist = 1/(distSquare * 4 * pow(M_PI,2));
+        shadowValue = m_energy * std::max(0.0f,cosTheta) * reflecMulDist;
+        return true;
+    }
     std::string toString() const{
         return "SimpleIntegrator[]";
     }
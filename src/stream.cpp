@@ -0,0 +1,162 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/stream.h>
+#include <ImfTiledOutputFile.h>
+#include <ImfChannelList.h>
+#include <ImfStringAttribute.h>
+#include <ImfFrameBuffer.h>
+#include <ctime>
+
+NORI_NAMESPACE_BEGIN
+
+struct TileStream::EXRFile {
+    EXRFile(const std::string &path, const Imf::Header &header)
+        : file(path.c_str(), header) { }
+
+    Imf::TiledOutputFile file;
+};
+
+TileStream::TileStream(const std::string &filename, const Vector2i &size,
+                       const ReconstructionFilter *filter, const EXROptions &options,
+                       const std::map<std::string, std::string> &metadata)
+        : m_size(size) {
+    m_numBlocks = Vector2i(
+        (size.x() + NORI_BLOCK_SIZE - 1) / NORI_BLOCK_SIZE,
+        (size.y() + NORI_BLOCK_SIZE - 1) / NORI_BLOCK_SIZE);
+    m_borderSize = ImageBlock(Vector2i(0, 0), filter).getBorderSize();
+    m_rows.resize(m_numBlocks.y());
+    m_pendingBlocks.resize(m_numBlocks.y(), m_numBlocks.x());
+    m_written.resize(m_numBlocks.y(), false);
+
+    cout << "Streaming a " << size.x() << "x" << size.y() << " OpenEXR file ("
+         << options.toString() << ") to \"" << filename << "\"" << endl;
+
+    Imf::Header header(size.x(), size.y());
+    header.insert("comments", Imf::StringAttribute("Generated by Nori"));
+    header.insert("id", Imf::StringAttribute(std::to_string(std::time(nullptr))));
+    for (const auto &attr : metadata)
+        header.insert(attr.first, Imf::StringAttribute(attr.second));
+    header.compression() = (Imf::Compression) options.compression;
+
+    /* Rows of tiles are completed in no particular order */
+    header.lineOrder() = Imf::RANDOM_Y;
+    header.setTileDescription(Imf::TileDescription(
+        NORI_BLOCK_SIZE, NORI_BLOCK_SIZE, Imf::ONE_LEVEL));
+
+    Imf::PixelType type = options.half ? Imf::HALF : Imf::FLOAT;
+    Imf::ChannelList &channels = header.channels();
+    channels.insert("R", Imf::Channel(type));
+    channels.insert("G", Imf::Channel(type));
+    channels.insert("B", Imf::Channel(type));
+
+    m_file.reset(new EXRFile(filename + ".exr", header));
+}
+
+TileStream::~TileStream() { }
+
+void TileStream::put(ImageBlock &block) {
+    if (block.getBorderSize() != m_borderSize)
+        throw NoriException("TileStream::put(): the block uses a different reconstruction filter!");
+
+    const Point2i &offset = block.getOffset();
+    int width = block.getSize().x() + 2 * m_borderSize,
+        height = block.getSize().y() + 2 * m_borderSize,
+        blockRow = offset.y() / NORI_BLOCK_SIZE;
+
+    tbb::mutex::scoped_lock lock(m_mutex);
+
+    /* Add the scanlines of the block (including its border) to the rows they belong to */
+    for (int j=0; j<height; ++j) {
+        int y = offset.y() - m_borderSize + j;
+        if (y < 0 || y >= m_size.y())
+            continue;
+
+        int index = y / NORI_BLOCK_SIZE;
+        if (m_written[index])
+            continue;
+
+        std::unique_ptr<Row> &row = m_rows[index];
+        if (!row) {
+            int rowHeight = std::min(NORI_BLOCK_SIZE, m_size.y() - index * NORI_BLOCK_SIZE);
+            row.reset(new Row(rowHeight, m_size.x() + 2 * m_borderSize));
+            row->setConstant(Color4f());
+            m_peakRows = std::max(m_peakRows, ++m_residentRows);
+        }
+
+        /* Column 0 of a row corresponds to pixel -borderSize of the image */
+        row->row(y - index * NORI_BLOCK_SIZE).segment(offset.x(), width)
+            += block.row(j).head(width);
+    }
+
+    /* Write the rows that no longer receive contributions */
+    --m_pendingBlocks[blockRow];
+    for (int index = std::max(0, blockRow - 1);
+         index <= std::min(m_numBlocks.y() - 1, blockRow + 1); ++index) {
+        bool complete = !m_written[index];
+        for (int k = std::max(0, index - 1); k <= std::min(m_numBlocks.y() - 1, index + 1); ++k)
+            complete &= m_pendingBlocks[k] == 0;
+        if (complete)
+            writeRow(index);
+    }
+}
+
+void TileStream::finish() {
+    tbb::mutex::scoped_lock lock(m_mutex);
+    for (int index=0; index<m_numBlocks.y(); ++index) {
+        if (!m_written[index])
+            writeRow(index);
+    }
+}
+
+void TileStream::writeRow(int index) {
+    int y0 = index * NORI_BLOCK_SIZE;
+    Bitmap bitmap(Vector2i(m_size.x(), std::min(NORI_BLOCK_SIZE, m_size.y() - y0)));
+
+    const Row *row = m_rows[index].get();
+    if (row) {
+        for (int y=0; y<bitmap.rows(); ++y)
+            for (int x=0; x<bitmap.cols(); ++x)
+                bitmap.coeffRef(y, x) = row->coeff(y, x + m_borderSize).divideByFilterWeight();
+    } else {
+        /* None of the blocks overlapping this row were rendered */
+        bitmap.setConstant(Color3f(0.0f));
+    }
+
+    /* OpenEXR addresses pixels by their position in the full image */
+    size_t compStride = sizeof(float),
+           pixelStride = 3 * compStride,
+           rowStride = pixelStride * m_size.x();
+    char *ptr = reinterpret_cast<char *>(bitmap.data()) - y0 * rowStride;
+
+    Imf::FrameBuffer frameBuffer;
+    frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+
+    m_file->file.setFrameBuffer(frameBuffer);
+    m_file->file.writeTiles(0, m_file->file.numXTiles() - 1, index, index);
+
+    if (row) {
+        m_rows[index].reset();
+        --m_residentRows;
+    }
+    m_written[index] = true;
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,252 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/wavefront.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <nori/block.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
+#include <limits>
+
+NORI_NAMESPACE_BEGIN
+
+/// Scramble the bits of a 64-bit integer (the finalizer of SplitMix64)
+static inline uint64_t mixBits(uint64_t v) {
+    v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ull;
+    v = (v ^ (v >> 27)) * 0x94d049bb133111ebull;
+    return v ^ (v >> 31);
+}
+
+/**
+ * \brief Sampler that draws from the random number generator of one sample
+ *
+ * Lets the integrator's \ref Integrator::shade() continue the random number
+ * stream of a sample that was started in an earlier stage.
+ */
+class PathSampler : public Sampler {
+public:
+    PathSampler(pcg32 &random) : m_random(random) { }
+
+    std::unique_ptr<Sampler> clone() const {
+        throw NoriException("PathSampler::clone(): not supported!");
+    }
+
+    void prepare(const ImageBlock &, uint32_t) { }
+    void generate() { }
+    void advance() { }
+
+    float next1D() {
+        return m_random.nextFloat();
+    }
+
+    Point2f next2D() {
+        return Point2f(
+            m_random.nextFloat(),
+            m_random.nextFloat()
+        );
+    }
+
+    std::string toString() const { return "PathSampler[]"; }
+private:
+    pcg32 &m_random;
+};
+
+WavefrontRenderer::WavefrontRenderer(const Scene *scene) : m_scene(scene) {
+    if (!scene->getIntegrator()->isWavefront())
+        throw NoriException("The integrator does not support wavefront rendering!");
+}
+
+void WavefrontRenderer::renderPass(BlockGenerator &generator, uint32_t pass,
+        uint32_t sampleCount, ImageBlock &result, const std::atomic<bool> &abort) {
+    ImageBlock block(Vector2i(NORI_BLOCK_SIZE), nullptr);
+    bool more = generator.next(block);
+
+    while (more && !abort) {
+        /* Gather blocks until the wavefront is full (but take at least one) */
+        m_blocks.clear();
+        uint64_t pathCount = 0;
+        do {
+            uint64_t blockPaths = (uint64_t) block.getSize().prod() * sampleCount;
+            if (!m_blocks.empty() && pathCount + blockPaths > NORI_WAVEFRONT_SIZE)
+                break;
+            m_blocks.push_back(WaveBlock { block.getOffset(), block.getSize(),
+                                           (uint32_t) pathCount });
+            pathCount += blockPaths;
+            more = generator.next(block);
+        } while (more);
+
+        if (pathCount > std::numeric_limits<uint32_t>::max())
+            throw NoriException("WavefrontRenderer: too many samples per block!");
+        m_pathCount = (uint32_t) pathCount;
+
+        generate(pass, sampleCount);
+        if (abort)
+            break;
+        intersect();
+        if (abort)
+            break;
+        shade();
+        traceShadowRays();
+        if (abort)
+            break;
+        accumulate(result);
+    }
+}
+
+Ray3f WavefrontRenderer::getRay(uint32_t i) const {
+    return Ray3f(
+        Point3f(m_originX[i], m_originY[i], m_originZ[i]),
+        Vector3f(m_dirX[i], m_dirY[i], m_dirZ[i])
+    );
+}
+
+void WavefrontRenderer::generate(uint32_t pass, uint32_t sampleCount) {
+    uint32_t n = m_pathCount;
+    m_pixelX.resize(n); m_pixelY.resize(n);
+    m_originX.resize(n); m_originY.resize(n); m_originZ.resize(n);
+    m_dirX.resize(n); m_dirY.resize(n); m_dirZ.resize(n);
+    m_weight.resize(n); m_radiance.resize(n);
+    m_random.resize(n);
+    m_hit.resize(n);
+    m_its.resize(n);
+    m_hasShadowRay.resize(n);
+    m_shadowRay.resize(n);
+    m_shadowValue.resize(n);
+
+    const Camera *camera = m_scene->getCamera();
+    int width = camera->getOutputSize().x();
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_blocks.size()),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t b = range.begin(); b != range.end(); ++b) {
+                const WaveBlock &block = m_blocks[b];
+                uint32_t i = block.start;
+
+                for (int y = 0; y < block.size.y(); ++y) {
+                    for (int x = 0; x < block.size.x(); ++x) {
+                        Point2i pixel = block.offset + Vector2i(x, y);
+                        uint64_t pixelIndex = (uint64_t) pixel.y() * width + pixel.x();
+
+                        for (uint32_t s = 0; s < sampleCount; ++s, ++i) {
+                            /* Every sample uses a separate stream of the generator,
+                               starting from a hashed state that differs per pass */
+                            uint64_t sampleIndex = pixelIndex * sampleCount + s;
+                            m_random[i].seed(mixBits(sampleIndex ^ ((uint64_t) pass << 48)), sampleIndex);
+                            PathSampler sampler(m_random[i]);
+
+                            Point2f pixelSample = pixel.cast<float>() + sampler.next2D();
+                            Point2f apertureSample = sampler.next2D();
+
+                            Ray3f ray;
+                            m_weight[i] = camera->sampleRay(ray, pixelSample, apertureSample);
+
+                            m_pixelX[i] = pixelSample.x(); m_pixelY[i] = pixelSample.y();
+                            m_originX[i] = ray.o.x(); m_originY[i] = ray.o.y(); m_originZ[i] = ray.o.z();
+                            m_dirX[i] = ray.d.x(); m_dirY[i] = ray.d.y(); m_dirZ[i] = ray.d.z();
+                        }
+                    }
+                }
+            }
+        }
+    );
+}
+
+void WavefrontRenderer::intersect() {
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, m_pathCount),
+        [&](const tbb::blocked_range<uint32_t> &range) {
+            for (uint32_t i = range.begin(); i != range.end(); ++i)
+                m_hit[i] = m_scene->rayIntersect(getRay(i), m_its[i]) ? 1 : 0;
+        }
+    );
+}
+
+void WavefrontRenderer::shade() {
+    const Integrator *integrator = m_scene->getIntegrator();
+
+    /* Shade hits grouped by material so that neighboring work items
+       run the same BSDF code. Misses come first (BSDF = nullptr) */
+    m_shadeQueue.resize(m_pathCount);
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, m_pathCount),
+        [&](const tbb::blocked_range<uint32_t> &range) {
+            for (uint32_t i = range.begin(); i != range.end(); ++i)
+                m_shadeQueue[i] = std::make_pair(
+                    m_hit[i] ? m_its[i].mesh->getBSDF() : nullptr, i);
+        }
+    );
+    tbb::parallel_sort(m_shadeQueue.begin(), m_shadeQueue.end());
+
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, m_pathCount),
+        [&](const tbb::blocked_range<uint32_t> &range) {
+            for (uint32_t k = range.begin(); k != range.end(); ++k) {
+                uint32_t i = m_shadeQueue[k].second;
+                PathSampler sampler(m_random[i]);
+                m_hasShadowRay[i] = integrator->shade(m_scene, &sampler, getRay(i),
+                    m_hit[i] ? &m_its[i] : nullptr, m_radiance[i],
+                    m_shadowRay[i], m_shadowValue[i]) ? 1 : 0;
+            }
+        }
+    );
+}
+
+void WavefrontRenderer::traceShadowRays() {
+    /* Compact the occlusion rays into a dense queue */
+    m_shadowQueue.clear();
+    for (uint32_t i = 0; i < m_pathCount; ++i) {
+        if (m_hasShadowRay[i])
+            m_shadowQueue.push_back(i);
+    }
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_shadowQueue.size()),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t k = range.begin(); k != range.end(); ++k) {
+                uint32_t i = m_shadowQueue[k];
+                if (!m_scene->rayIntersect(m_shadowRay[i]))
+                    m_radiance[i] += m_shadowValue[i];
+            }
+        }
+    );
+}
+
+void WavefrontRenderer::accumulate(ImageBlock &result) {
+    const ReconstructionFilter *filter = m_scene->getCamera()->getReconstructionFilter();
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_blocks.size()),
+        [&](const tbb::blocked_range<size_t> &range) {
+            ImageBlock block(Vector2i(NORI_BLOCK_SIZE), filter);
+
+            for (size_t b = range.begin(); b != range.end(); ++b) {
+                const WaveBlock &waveBlock = m_blocks[b];
+                uint32_t end = b + 1 < m_blocks.size() ? m_blocks[b + 1].start : m_pathCount;
+
+                block.setOffset(waveBlock.offset);
+                block.setSize(waveBlock.size);
+                block.clear();
+
+                for (uint32_t i = waveBlock.start; i < end; ++i)
+                    block.put(Point2f(m_pixelX[i], m_pixelY[i]), m_weight[i] * m_radiance[i]);
+
+                result.put(block);
+            }
+        }
+    );
+}
+
+NORI_NAMESPACE_END